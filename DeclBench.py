@@ -0,0 +1,400 @@
+"""Synthetic-scale benchmarks of the whole header generation pipeline
+
+'generate' writes a synthetic header tree and a module of sources using it:
+
+  <tree>/include/bench/types.h
+  <tree>/include/bench/h<i>.h     headers in include chains of --depth, each
+                                  including the next one of its chain
+  <tree>/bench/s<i>.c             sources of the module, each including the
+                                  heads of some chains
+
+Every header has --decls decls (structs, function pointer heavy 'ops'
+structs, prototypes, externs, typedefs, inline functions and enums) and
+--macros macros, which refer to decls and macros further down their chain.
+Sources use --uses of them, plus --missed identifiers hidden from DeclFilter
+by '#ifndef BENCH_ANALYSED': the plugin runs with BENCH_ANALYSED defined and
+the composer compiles without it, so these dependencies are only found by
+the fix rounds of Phase 2, as enumerators (one round) or members of externs
+of structs otherwise unused (two rounds).
+
+'run' generates a tree and runs the pipeline on it as the Makefiles do:
+DeclFilter per source (in parallel), DeclMerge.py and DeclComposer.py with
+its three phases. Wall time, CPU time and peak RSS of every stage, the size
+of the database, the rounds of Phase 2 and the size of the output are
+appended as one JSON object per line to the results file.
+
+The environment has to be set up by envsetup.sh.
+
+Usage:
+    python DeclBench.py generate [options] <tree>
+    python DeclBench.py run [--preset <name>] [options] [-o <results>] <tree>
+"""
+
+import os
+import sys
+import time
+import json
+import random
+import shutil
+import sqlite3
+import argparse
+import multiprocessing
+from multiprocessing.pool import ThreadPool
+from subprocess import Popen, PIPE
+
+PRESETS = {
+    'small':  dict(headers=64, decls=16, depth=4, macros=8, fnptrs=4, sources=4, includes=4, uses=32, missed=4),
+    'medium': dict(headers=512, decls=48, depth=8, macros=24, fnptrs=8, sources=8, includes=16, uses=128, missed=16),
+    'large':  dict(headers=2048, decls=96, depth=16, macros=48, fnptrs=16, sources=16, includes=32, uses=512, missed=64),
+}
+
+MODULE = 'bench'
+
+# Decls of a header cycle through these kinds, a struct first so that every
+# header has one for the others to point to
+KINDS = ['struct', 'function', 'var', 'ops', 'typedef', 'inline', 'enum', 'wrapped']
+
+
+class Tree:
+    """Decls and macros of the generated headers, by header"""
+
+    def __init__(self, opts):
+        self.opts = opts
+        self.rand = random.Random(opts.seed)
+        # [(kind, name)] per header
+        self.decls = []
+        self.macros = []
+
+    def chain(self, i):
+        """Headers included by header @i, itself included"""
+        end = (i // self.opts.depth + 1) * self.opts.depth
+        return range(i, min(end, self.opts.headers))
+
+    def below(self, i):
+        """A header included by header @i, or @i itself"""
+        return self.rand.choice(self.chain(i))
+
+    def header(self, i):
+        o = self.opts
+        out = []
+        out.append('#ifndef BENCH_H%d_H' % i)
+        out.append('#define BENCH_H%d_H' % i)
+        out.append('')
+        out.append('#include <bench/types.h>')
+        if i + 1 in self.chain(i):
+            out.append('#include <bench/h%d.h>' % (i + 1))
+        out.append('')
+
+        macros = []
+        for j in range(o.macros):
+            name = 'H%d_M%d' % (i, j)
+            k = self.below(i)
+            if k != i and self.macros[k]:
+                out.append('#define %s (%d + %s)' % (name, j, self.macros[k][0]))
+            elif j:
+                out.append('#define %s (%d + %s)' % (name, j, macros[j - 1]))
+            else:
+                out.append('#define %s %d' % (name, i + 1))
+            macros.append(name)
+        if macros:
+            out.append('#define H%d_ADD(x) ((x) + %s)' % (i, macros[-1]))
+            out.append('')
+        # Note: headers are generated from the end of their chain up
+        self.macros[i] = macros
+
+        decls = []
+        for j in range(o.decls):
+            kind = KINDS[j % len(KINDS)]
+            s0 = 'struct h%d_s0' % i
+            next_s0 = 'struct h%d_s0' % self.below(i)
+            if kind == 'struct':
+                name = 'h%d_s%d' % (i, j)
+                out.append('struct %s {' % name)
+                out.append('\tu32 a;')
+                out.append('\t%s *next;' % next_s0)
+                out.append('\tunsigned long flags[%s];' % (macros[0] if macros else '4'))
+                out.append('};')
+            elif kind == 'function':
+                name = 'h%d_f%d' % (i, j)
+                out.append('int %s(%s *a, int b);' % (name, s0))
+            elif kind == 'var':
+                name = 'h%d_v%d' % (i, j)
+                out.append('extern int %s;' % name)
+            elif kind == 'ops':
+                name = 'h%d_ops%d' % (i, j)
+                out.append('struct %s {' % name)
+                for f in range(o.fnptrs):
+                    if f % 3 == 0:
+                        out.append('\tint (*op%d)(%s *, unsigned long);' % (f, next_s0))
+                    elif f % 3 == 1:
+                        out.append('\tvoid (*(*op%d)(int))(void *);' % f)
+                    else:
+                        out.append('\tint (*op%d[4])(%s *);' % (f, s0))
+                out.append('\tu32 count;')
+                out.append('};')
+            elif kind == 'typedef':
+                name = 'h%d_t%d' % (i, j)
+                out.append('typedef %s *%s;' % (next_s0, name))
+            elif kind == 'inline':
+                name = 'h%d_i%d' % (i, j)
+                body = 'H%d_ADD(x)' % i if macros else 'x + %d' % j
+                out.append('static inline int %s(int x) { return %s; }' % (name, body))
+            elif kind == 'enum':
+                name = 'H%d_E%d' % (i, j)
+                out.append('enum h%d_e%d { %s_A, %s };' % (i, j, name, name))
+            else:
+                # An extern of a struct of its own, only used by the missed
+                # dependencies
+                name = 'h%d_w%d' % (i, j)
+                out.append('struct h%d_ws%d { u32 a; };' % (i, j))
+                out.append('extern struct h%d_ws%d %s;' % (i, j, name))
+            decls.append((kind, name))
+        self.decls[i] = decls
+
+        out.append('')
+        out.append('#endif')
+        return '\n'.join(out) + '\n'
+
+    def use(self, kind, name, n):
+        """(global, statement) using the decl @name"""
+        if kind == 'struct':
+            return ('struct %s g%d;' % (name, n), None)
+        if kind == 'function':
+            return (None, 'total += %s(0, n);' % name)
+        if kind == 'var':
+            return (None, 'total += %s;' % name)
+        if kind == 'ops':
+            return ('struct %s g%d;' % (name, n), None)
+        if kind == 'typedef':
+            return ('%s g%d;' % (name, n), None)
+        if kind == 'inline':
+            return (None, 'total += %s(n);' % name)
+        if kind == 'enum':
+            return (None, 'total += %s;' % name)
+        if kind == 'macro':
+            return (None, 'total += %s;' % name)
+        return (None, 'total += %s.a;' % name)
+
+    def source(self, s):
+        o = self.opts
+        heads = range(0, o.headers, o.depth)
+        included = sorted(self.rand.sample(heads, min(o.includes, len(heads))))
+        visible = []
+        for h in included:
+            visible.extend(self.chain(h))
+
+        out = ['#include <bench/h%d.h>' % h for h in included]
+        out.append('')
+        globals = []
+        stmts = []
+        for n in range(o.uses):
+            h = self.rand.choice(visible)
+            candidates = [d for d in self.decls[h] if d[0] != 'wrapped']
+            candidates += [('macro', m) for m in self.macros[h]]
+            if not candidates:
+                continue
+            kind, name = self.rand.choice(candidates)
+            g, stmt = self.use(kind, name, n)
+            if g:
+                globals.append(g.replace(' g%d;' % n, ' s%d_g%d;' % (s, n)))
+            if stmt:
+                stmts.append(stmt)
+
+        missed = []
+        for n in range(o.missed):
+            h = self.rand.choice(visible)
+            candidates = [d for d in self.decls[h] if d[0] in ('enum', 'wrapped')]
+            if not candidates:
+                continue
+            kind, name = self.rand.choice(candidates)
+            missed.append(self.use(kind, name, n)[1])
+
+        out.extend(globals)
+        out.append('')
+        out.append('int s%d_run(int n)' % s)
+        out.append('{')
+        out.append('\tint total = 0;')
+        out.extend(['\t' + stmt for stmt in stmts])
+        if missed:
+            out.append('#ifndef BENCH_ANALYSED')
+            out.extend(['\t' + stmt for stmt in missed])
+            out.append('#endif')
+        out.append('\treturn total;')
+        out.append('}')
+        return '\n'.join(out) + '\n'
+
+    def write(self, root):
+        o = self.opts
+        if os.path.isdir(root):
+            shutil.rmtree(root)
+        include = os.path.join(root, 'include', 'bench')
+        module = os.path.join(root, MODULE)
+        os.makedirs(include)
+        os.makedirs(module)
+
+        write_file(os.path.join(include, 'types.h'),
+                   '#ifndef BENCH_TYPES_H\n#define BENCH_TYPES_H\n\n'
+                   'typedef unsigned int u32;\n\n#endif\n')
+        self.decls = [None] * o.headers
+        self.macros = [None] * o.headers
+        for i in reversed(range(o.headers)):
+            write_file(os.path.join(include, 'h%d.h' % i), self.header(i))
+        for s in range(o.sources):
+            write_file(os.path.join(module, 's%d.c' % s), self.source(s))
+
+
+def write_file(path, content):
+    fout = open(path, 'w')
+    fout.write(content)
+    fout.close()
+
+
+def run(cmd, cwd, stdout=None):
+    """Run @cmd in @cwd, returning (return code, wall time in s, CPU time in s
+    and peak RSS in KiB of it and its children). Lines of output are passed
+    to @stdout(line, time) as they come if given."""
+    start = time.time()
+    p = Popen(cmd, cwd=cwd, stdin=None, stdout=PIPE if stdout else open(os.devnull, 'w'),
+              stderr=open(os.devnull, 'w'), close_fds=True)
+    if stdout:
+        for line in iter(p.stdout.readline, b''):
+            stdout(line.decode('utf-8', 'replace') if not isinstance(line, str) else line, time.time() - start)
+        p.stdout.close()
+    # Note: wait4() reports the peak RSS of the process and of the children
+    #       it waited for, e.g. the clang runs of the composer
+    pid, status, usage = os.wait4(p.pid, 0)
+    p.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+    return p.returncode, time.time() - start, usage.ru_utime + usage.ru_stime, usage.ru_maxrss
+
+
+def stage(results):
+    """Aggregate of the runs of a stage"""
+    return {
+        'wall': results[0],
+        'cpu': sum([r[2] for r in results[1]]),
+        'max_rss_kb': max([r[3] for r in results[1]]),
+        'failed': len([r for r in results[1] if r[0] != 0]),
+    }
+
+
+def tree_bytes(path):
+    total = 0
+    for root, dirs, files in os.walk(path):
+        for f in files:
+            total += os.path.getsize(os.path.join(root, f))
+    return total
+
+
+def benchmark(opts, root):
+    top = os.environ['TOP']
+    clang = os.environ['CLANG']
+    module = os.path.join(root, MODULE)
+    sources = sorted([f for f in os.listdir(module) if f.endswith('.c')],
+                     key=lambda f: int(f[1:-2]))
+    result = {'preset': opts.preset, 'params': dict([(k, getattr(opts, k)) for k in PRESETS['small']]),
+              'seed': opts.seed, 'stages': {}}
+
+    # DeclFilter, one shard per source as for directories in Makefile.inc
+    def analyse(source):
+        base = os.path.join(MODULE, source[:-2])
+        cmd = [clang, '-Iinclude', '-DBENCH_ANALYSED', '-w', '-c', '-o', base + '.oo', base + '.c',
+               '-Xclang', '-load', '-Xclang', os.path.join(top, 'DeclFilter.so'),
+               '-Xclang', '-add-plugin', '-Xclang', 'decl-filter',
+               '-Xclang', '-plugin-arg-decl-filter', '-Xclang', base + '.shard.sqlite']
+        return run(cmd, root)
+    start = time.time()
+    pool = ThreadPool(opts.jobs)
+    runs = pool.map(analyse, sources)
+    pool.close()
+    result['stages']['plugin'] = stage((time.time() - start, runs))
+
+    db = MODULE + '.sqlite'
+    shards = [os.path.join(MODULE, f[:-2] + '.shard.sqlite') for f in sources]
+    r = run([sys.executable, os.path.join(top, 'DeclMerge.py'), '-o', db] + shards, root)
+    result['stages']['merge'] = stage((r[1], [r]))
+    result['db_bytes'] = os.path.getsize(os.path.join(root, db)) if r[0] == 0 else 0
+
+    # Note: the phases are timed by the lines the composer prints as it
+    #       enters them
+    phases = []
+    def progress(line, t):
+        if line.startswith('Phase '):
+            phases.append(t)
+    cmd = [sys.executable, '-u', os.path.join(top, 'DeclComposer.py'), '-o', MODULE + '.d', '--db', db,
+           '-j', str(opts.jobs), MODULE]
+    verifier = os.path.join(top, 'HeaderVerifier')
+    if os.path.exists(verifier):
+        cmd[2:2] = ['--verifier', verifier]
+    r = run(cmd, root, progress)
+    result['stages']['compose'] = stage((r[1], [r]))
+    phases.append(r[1])
+    for n in range(len(phases) - 1):
+        result['stages']['phase%d' % (n + 1)] = {'wall': phases[n + 1] - phases[n]}
+    result['succeeded'] = r[0] == 0
+
+    rounds = []
+    results = os.path.join(root, MODULE + '.results.sqlite')
+    if os.path.isfile(results):
+        conn = sqlite3.connect(results)
+        try:
+            rounds = [row[0] for row in conn.execute('SELECT rounds FROM fix_rounds')]
+        except sqlite3.Error:
+            pass
+        conn.close()
+    result['rounds'] = {'max': max(rounds) if rounds else 0, 'total': sum(rounds)}
+
+    output = tree_bytes(os.path.join(root, MODULE + '.d'))
+    dummy = os.path.join(root, MODULE + '.dummy.c')
+    if os.path.isfile(dummy):
+        output += os.path.getsize(dummy)
+    result['output_bytes'] = output
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='synthetic-scale benchmarks of header-gen')
+    parser.add_argument('command', choices=['generate', 'run'])
+    parser.add_argument('tree', help='directory to generate the tree in')
+    parser.add_argument('--preset', choices=sorted(PRESETS.keys()), default='small',
+                        help='sizes to start from, overridden by the options below')
+    parser.add_argument('--headers', type=int, help='number of headers')
+    parser.add_argument('--decls', type=int, help='decls per header')
+    parser.add_argument('--depth', type=int, help='length of the include chains')
+    parser.add_argument('--macros', type=int, help='macros per header')
+    parser.add_argument('--fnptrs', type=int, help='function pointers per ops struct')
+    parser.add_argument('--sources', type=int, help='sources of the module')
+    parser.add_argument('--includes', type=int, help='chains included per source')
+    parser.add_argument('--uses', type=int, help='decls and macros used per source')
+    parser.add_argument('--missed', type=int, help='dependencies per source DeclFilter does not see')
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count())
+    parser.add_argument('-o', '--output', help='file to append the results to (default: stdout)')
+    opts = parser.parse_args()
+
+    for k, v in PRESETS[opts.preset].items():
+        if getattr(opts, k) is None:
+            setattr(opts, k, v)
+    if opts.headers < 1 or opts.depth < 1 or opts.decls < 1:
+        sys.stderr.write('at least one header of one decl and a depth of one are needed\n')
+        sys.exit(1)
+
+    start = time.time()
+    Tree(opts).write(opts.tree)
+    if opts.command == 'generate':
+        return
+    generated = time.time() - start
+
+    result = benchmark(opts, opts.tree)
+    result['stages']['generate'] = {'wall': generated}
+    line = json.dumps(result, sort_keys=True)
+    if opts.output:
+        fout = open(opts.output, 'a')
+        fout.write(line + '\n')
+        fout.close()
+    else:
+        sys.stdout.write(line + '\n')
+    if not result['succeeded']:
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
@@ -3,9 +3,18 @@ import re
 import argparse
 import sqlite3
 import functools
-import shutil
+import hashlib
+import shlex
+import Queue
+import threading
+import multiprocessing
+from multiprocessing.pool import ThreadPool
+from cStringIO import StringIO
 from termcolor import colored, cprint
 from subprocess import Popen, PIPE
+from DeclIndex import DeclIndex, SCHEMA_VERSION, schema_version
+from DeclLedger import Ledger
+from DeclErrors import classify
 
 REMOVE_INLINE_DEFINITIONS = True if os.environ['REMOVE_INLINE_DEFINITIONS'] else False
 
@@ -64,6 +73,74 @@ def mkdir(d):
     if not os.path.isdir(d):
         os.makedirs(d)
 
+def write_if_changed(target, content):
+    """Write @content to @target unless it holds it already, so that neither
+    its content nor its mtime change. Returns whether @target was written."""
+    try:
+        if os.path.getsize(target) == len(content):
+            fin = open(target, 'rb')
+            same = fin.read() == content
+            fin.close()
+            if same:
+                return False
+    except OSError:
+        mkdir(os.path.dirname(target))
+    # Note: @target may be a hard link into the header cache, which must not
+    #       be written through
+    tmp = '%s.%d.tmp' % (target, os.getpid())
+    fout = open(tmp, 'wb')
+    fout.write(content)
+    fout.close()
+    os.rename(tmp, target)
+    return True
+
+def cache_path(key):
+    return os.path.join(cache_dir, key[:2], key[2:] + '.h')
+
+def link_cached(target, key, render):
+    """Make a new @target a hard link to the header cached under @key, which
+    is rendered by @render() unless cached yet, or update an existing one to
+    its content. Returns whether @target was changed."""
+    cached = cache_path(key)
+    if os.path.isfile(cached):
+        Header.cache_hits += 1
+    else:
+        Header.cache_misses += 1
+        mkdir(os.path.dirname(cached))
+        # Note: modules are generated concurrently, the cache is only ever
+        #       added whole files to
+        tmp = '%s.%d.tmp' % (cached, os.getpid())
+        fout = open(tmp, 'wb')
+        fout.write(render())
+        fout.close()
+        os.rename(tmp, cached)
+
+    if os.path.exists(target):
+        if os.path.samefile(target, cached):
+            return False
+        # Note: a header which already exists is copied rather than linked.
+        #       A link carries the mtime of the cached header, which may well
+        #       be older than the objects built against the previous content,
+        #       and touching it would touch the header of every module
+        #       linking it. Headers of the same content are left alone.
+        fin = open(cached, 'rb')
+        content = fin.read()
+        fin.close()
+        return write_if_changed(target, content)
+
+    mkdir(os.path.dirname(target))
+    tmp = '%s.%d.tmp' % (target, os.getpid())
+    try:
+        os.link(cached, tmp)
+    except OSError:
+        # e.g. the cache is on another file system
+        fin = open(cached, 'rb')
+        content = fin.read()
+        fin.close()
+        return write_if_changed(target, content)
+    os.rename(tmp, target)
+    return True
+
 def random_fixes(lines, relpath, source_range):
     def get_line(linum):
         return re.sub('/\*.*\*/', '', lines[linum - 1]).rstrip()
@@ -180,13 +257,21 @@ class SourcePosition:
 
 @functools.total_ordering
 class SourceRange:
-    def __init__(self, start, end, name, kind, from_macro = False, has_body = False):
+    def __init__(self, start, end, name, kind, from_macro = False, has_body = False,
+                 start_offset = None, end_offset = None):
         self.start = start
         self.end = end
         self.name = name
         self.kind = kind
         self.from_macro = from_macro
         self.has_body = has_body
+        # Exact [start_offset, end_offset) extent in the header if the
+        # compiler reported one, see clang-plugins/decl-filter/SourceExtent.h
+        self.start_offset = start_offset
+        self.end_offset = end_offset
+
+    def has_extent(self):
+        return self.start_offset is not None and self.start_offset < self.end_offset
 
     def __eq__(self, other):
         return (self.start == other.start) and (self.end == other.end)
@@ -200,15 +285,31 @@ class SourceRange:
 
 class Header:
     headers = {}
+    # Headers whose ranges changed since they were last dumped
+    dirty = set()
+    prefetched = False
+    written = 0
+    unchanged = 0
+    cache_hits = 0
+    cache_misses = 0
 
     @staticmethod
-    def dumpall():
+    def pushall(verifier):
         for k,v in Header.headers.items():
+            v.push(verifier)
+
+    @staticmethod
+    def dumpall():
+        dirty = Header.dirty
+        Header.dirty = set()
+        for v in dirty:
             v.dump(workdir)
-        for h in prefetch_headers:
-            target = os.path.join(workdir, *h)
-            mkdir(os.path.dirname(target))
-            shutil.copy2(os.path.join(source_dir, 'include', *h), target)
+        if not Header.prefetched:
+            for h in prefetch_headers:
+                fin = open(os.path.join(source_dir, 'include', *h), 'rb')
+                write_if_changed(os.path.join(workdir, *h), fin.read())
+                fin.close()
+            Header.prefetched = True
 
     def __init__(self, path):
         self.abspath = path
@@ -218,74 +319,157 @@ class Header:
                 self.relpath = os.path.relpath(path, absdir)
                 break
         self.__decls = []
+        self.__content = None
         self.dumped = False
+        Header.dirty.add(self)
+        # Bumped on every change, to tell which verifiers are outdated
+        self.version = 0
+        self.__rendered = None
 
     def add_decl_range(self, r):
-        if not r in self.__decls:
-            self.__decls.append(r)
-            self.dumped = False
+        # Note: ranges with extents are told apart by them rather than by
+        #       their lines. Of nested ones the widest is kept, e.g. the
+        #       typedef defining a struct over the struct.
+        if r.has_extent():
+            for d in self.__decls:
+                if d.has_extent() and d.start_offset <= r.start_offset and r.end_offset <= d.end_offset:
+                    return
+            self.__decls = [d for d in self.__decls if not d.has_extent() or
+                            d.start_offset < r.start_offset or r.end_offset < d.end_offset]
+        elif r in self.__decls:
+            return
+        self.__decls.append(r)
+        self.dumped = False
+        self.version += 1
+        Header.dirty.add(self)
+
+    def __load(self):
+        if self.__content is None:
+            fin = open(self.abspath, 'r')
+            self.__content = fin.read()
+            fin.close()
+            self.__lines = self.__content.splitlines(True)
+            self.__line_offsets = [0]
+            for line in self.__lines:
+                self.__line_offsets.append(self.__line_offsets[-1] + len(line))
+
+    def __extent(self, decl_range):
+        """[start, end) offsets of the text to copy for @decl_range"""
+        if decl_range.has_extent():
+            return (decl_range.start_offset, decl_range.end_offset)
+        # Note: ranges without extents (e.g. from all_decls or inclusions)
+        #       are fixed up line by line
+        start_line, end_line = random_fixes(self.__lines, self.relpath, decl_range)
+        return (self.__line_offsets[start_line - 1],
+                self.__line_offsets[end_line - 1] + len(self.__lines[end_line - 1].rstrip('\r\n')))
+
+    def __extents(self):
+        return sorted([(self.__extent(r), r) for r in self.__decls], key=lambda x: x[0])
 
     # add by wh
-    # store comments to table header_comments
+    # rows of table header_comments
     def analyze_comments(self):
         if self.relpath == "":
             return
-        fin = open(self.abspath, 'r')
-        lines = fin.readlines()
-
-        for decl_range in sorted(self.__decls):
-            start_line, end_line = random_fixes(lines, self.relpath, decl_range)
-            comment = ''
-            if start_line < decl_range.start.line:
-                for i in range(start_line - 1, decl_range.start.line - 1):
-                    comment += lines[i]
-                cur.execute("INSERT INTO header_comments VALUES (?, ?, ?, ?, ?)", (self.abspath, decl_range.name, decl_range.start.line, decl_range.end.line, comment))
-                conn.commit()
-
-    def dump(self, workdir):
-        if self.relpath == "":
-            return
-        if self.dumped:
-            return
-        target = os.path.join(workdir, self.relpath)
-        mkdir(os.path.dirname(target))
-        fin = open(self.abspath, 'r')
-        fout = open(target, 'w+')
-        lines = fin.readlines()
+        self.__load()
+
+        for (start, end), decl_range in self.__extents():
+            decl_start = self.__line_offsets[decl_range.start.line - 1]
+            if start < decl_start:
+                comment = self.__content[start:decl_start]
+                yield (self.abspath, decl_range.name, decl_range.start.line, decl_range.end.line, comment)
+
+    def target(self, workdir):
+        return os.path.join(workdir, self.relpath)
+
+    def cache_key(self):
+        """Hash of everything the generated header is rendered from: the
+        source header, the ranges kept and the composer itself"""
+        self.__load()
+        h = hashlib.sha1(composer_hash)
+        h.update(self.relpath + '\0')
+        h.update(hashlib.sha1(self.__content).digest())
+        for r in sorted(self.__decls, key=lambda r: (r.start.line, r.end.line, r.kind, r.name)):
+            h.update(repr((r.kind, r.name, r.start.line, r.start.col, r.end.line, r.end.col,
+                           r.from_macro, r.has_body, r.start_offset, r.end_offset)))
+            # Note: inline definitions are replaced by prototypes of the database
+            if REMOVE_INLINE_DEFINITIONS and r.has_body:
+                row = lookup_prototype(r.name)
+                h.update(repr(row[1] if row else None))
+        return h.hexdigest()
+
+    def render(self):
+        """Content of the generated header"""
+        if self.__rendered and self.__rendered[0] == self.version:
+            return self.__rendered[1]
+        self.__rendered = (self.version, self.__render())
+        return self.__rendered[1]
+
+    def __render(self):
+        self.__load()
+        fout = StringIO()
 
         guard = '__%s__' % (self.relpath.replace('/', '_').replace('.', '_').replace('-', '_').upper())
         print >> fout, '#ifndef %s' % guard
         print >> fout, '#define %s' % guard
-        previous_start_line = 0
-        previous_end_line = 0
-        for decl_range in sorted(self.__decls):
+        previous_end = None
+        for (start, end), decl_range in self.__extents():
+            # Ranges sharing a line with the previous one are kept on it,
+            # ranges separated by skipped lines get a blank line in between
+            separator = ''
+            if previous_end is not None:
+                if end <= previous_end:
+                    if verbose:
+                        print "?!! Source range overlaped:", self.relpath, \
+                            '%d-%d in %d-%d' % (start, end, previous_start, previous_end)
+                    continue
+                start = max(start, previous_end)
+                newlines = self.__content.count('\n', previous_end, start)
+                separator = ' ' if newlines == 0 else '\n' if newlines == 1 else '\n\n'
+
             if REMOVE_INLINE_DEFINITIONS and decl_range.has_body:
-                cur.execute("SELECT * FROM prototypes WHERE name = '%s'" % decl_range.name)
-                row = cur.fetchone()
+                row = lookup_prototype(decl_range.name)
                 if row:
                     proto = row[1]
-                    print >> fout, proto + ';'
+                    fout.write(separator + proto + ';')
+                    previous_start, previous_end = start, end
                     continue
 
-            start_line, end_line = random_fixes(lines, self.relpath, decl_range)
-
-            if previous_end_line + 1 < start_line:
-                print >> fout
-            elif previous_end_line >= start_line:
-                if verbose:
-                    print "?!! Source range overlaped:", self.relpath, \
-                        '%d-%d vs. %d-%d' % (previous_start_line, previous_end_line, start_line, end_line)
-                continue
-
-            for i in range(start_line - 1, end_line):
-                print >> fout, lines[i].rstrip()
-
-            previous_start_line = start_line
-            previous_end_line = end_line
+            fout.write(separator + self.__content[start:end].rstrip())
+            previous_start, previous_end = start, end
+        if previous_end is not None:
+            print >> fout
         print >> fout
         print >> fout, '#endif /* ! %s */' % guard
+        return fout.getvalue()
+
+    def dump(self, workdir):
+        if self.relpath == "":
+            return
+        if self.dumped:
+            return
+        # Note: headers as generated by a previous run are left alone, so
+        #       that make does not rebuild what depends on them
+        if cache_dir:
+            changed = link_cached(self.target(workdir), self.cache_key(), self.render)
+        else:
+            changed = write_if_changed(self.target(workdir), self.render())
+        if changed:
+            Header.written += 1
+        else:
+            Header.unchanged += 1
         self.dumped = True
 
+    def push(self, verifier):
+        """Hand the generated header to @verifier instead of writing it"""
+        if self.relpath == "":
+            return
+        target = self.target(workdir)
+        if verifier.versions.get(target) == self.version:
+            return
+        verifier.update(target, self.render())
+        verifier.versions[target] = self.version
+
     def __str__(self):
         return '[' + ', '.join(map(lambda x: str(x), sorted(self.__decls))) + ']'
 
@@ -294,15 +478,29 @@ parser = argparse.ArgumentParser()
 parser.add_argument('-o', '--workdir', help='directory where generated headers should be placed', required=True)
 parser.add_argument('-m', '--mode', help='generate headers for linux sources', default="test")
 parser.add_argument('-v', '--verbose', action='store_true', help='print debug info')
-parser.add_argument('--db', help='declaration database', required=True)
+parser.add_argument('--db', help='declaration database')
+parser.add_argument('--index', help='binary declaration index written by DeclFilter with format=index, read instead of the database')
+parser.add_argument('--results', help='database to write the comments and fix rounds to, <workdir without .d>.results.sqlite by default')
+parser.add_argument('--symbols', help='kernel-wide symbol database to look up the identifiers of the headers it covers in, see \'make symbols\'')
+parser.add_argument('--verifier', help='resident HeaderVerifier to check sources with, instead of writing headers and running clang every round')
+parser.add_argument('--cache', help='content-addressed store of generated headers shared by all modules, which new generated headers are hard links to and changed ones are copied from')
+parser.add_argument('--ledger', help='timing ledger to append the records of the phases to, see DeclLedger.py')
+parser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count(), help='sources to fix concurrently')
 parser.add_argument('sources', nargs='?')
 args = parser.parse_args()
 
 workdir = args.workdir
+cache_dir = args.cache
+ledger = Ledger(args.ledger)
+if cache_dir:
+    # Note: cached headers are keyed on the composer which rendered them
+    fin = open(os.path.abspath(__file__), 'rb')
+    composer_hash = hashlib.sha1(fin.read()).digest()
+    fin.close()
 mode = args.mode
 verbose = args.verbose if args.verbose else False
 if os.path.isdir(args.sources):
-    sources = map(lambda x: os.path.join(args.sources, x), [f for f in os.listdir(args.sources) if f.endswith('.c')])
+    sources = map(lambda x: os.path.join(args.sources, x), sorted([f for f in os.listdir(args.sources) if f.endswith('.c')]))
     linked = args.sources + '.o'
     dummy_out = args.sources + '.dummy.c'
     module_is_dir = True
@@ -313,17 +511,78 @@ else:
     module_is_dir = False
 
 configure(mode)
-conn = sqlite3.connect(args.db)
-cur = conn.cursor()
+if not args.db and not args.index:
+    parser.error('either --db or --index is required')
+# Note: an index is read in place and needs no database at all
+index = DeclIndex(args.index) if args.index else None
+cur = None
+if not index:
+    conn = sqlite3.connect(args.db)
+    # Note: text comes back as the bytes the plugin copied from the sources,
+    #       e.g. comments, which are not necessarily UTF-8
+    conn.text_factory = str
+    cur = conn.cursor()
+    # Note: the tables and their indexes are created by DeclFilter, databases
+    #       of another version have to be rebuilt
+    if schema_version(conn) != SCHEMA_VERSION:
+        cprint('%s: schema version %d, expected %d. Rebuild it with the current DeclFilter.so.' % \
+               (args.db, schema_version(conn), SCHEMA_VERSION), 'red')
+        sys.exit(1)
+# Note: the plugin leaves the decls of the headers covered by the symbol
+#       database out of all_decls
+symbols_cur = None
+if args.symbols:
+    symbols_conn = sqlite3.connect(args.symbols)
+    if schema_version(symbols_conn) != SCHEMA_VERSION:
+        cprint('%s: schema version %d, expected %d. Rebuild it with \'make symbols\'.' % \
+               (args.symbols, schema_version(symbols_conn), SCHEMA_VERSION), 'red')
+        sys.exit(1)
+    symbols_cur = symbols_conn.cursor()
+# Note: the tables of the composer go to a database of their own, so that
+#       the declaration database stays as the plugin wrote it and its hash
+#       in the manifest still matches on the next run
+results_db = sqlite3.connect(args.results or os.path.splitext(workdir)[0] + '.results.sqlite')
+results_db.text_factory = str
+rcur = results_db.cursor()
+
+def fetch_rows(table):
+    if index:
+        return index.records(table)
+    cur.execute('SELECT * FROM %s' % table)
+    return cur.fetchall()
+
+# Rows of an index by key, built on the first lookup of each table. Of rows
+# sharing a key the first in primary key order is kept, the row the query
+# on the database returns.
+index_keys = {}
+
+def lookup(table, column, field, key):
+    """The row of @table whose @column, field @field of the rows, is @key"""
+    if index:
+        rows = index_keys.get(table)
+        if rows is None:
+            rows = {}
+            for row in index.records(table):
+                if not row[field] in rows or row < rows[row[field]]:
+                    rows[row[field]] = row
+            index_keys[table] = rows
+        return rows.get(key)
+    cur.execute('SELECT * FROM %s WHERE %s = ?' % (table, column), (key,))
+    return cur.fetchone()
+
+def lookup_prototype(name):
+    return lookup('prototypes', 'name', 0, name)
+
+def lookup_ident(name):
+    return lookup('all_decls', 'ident', 1, name)
 
 # Phase 1
 #     Generate the initial header set based on info from compiler
 ################################################################################
 print 'Phase 1: Generate initial header set...'
+stage = ledger.start('phase1')
 
-cur.execute('SELECT * FROM decls')
-rows = cur.fetchall()
-for row in rows:
+for row in fetch_rows('decls'):
     f = row[0]
     name = row[1]
     start_line = int(row[2])
@@ -332,6 +591,8 @@ for row in rows:
     end_col = int(row[5])
     from_macro = True if int(row[7]) == 1 else False
     has_body = True if int(row[8]) == 1 else False
+    start_offset = int(row[9]) if len(row) > 10 else None
+    end_offset = int(row[10]) if len(row) > 10 else None
     if not f:
         continue
     if not Header.headers.has_key(f):
@@ -339,26 +600,26 @@ for row in rows:
     spos = SourcePosition(start_line, start_col)
     epos = SourcePosition(end_line, end_col)
     Header.headers[f].add_decl_range(SourceRange(spos, epos, name, KIND_IDENTIFIER, \
-                                                 from_macro=from_macro, has_body=has_body))
+                                                 from_macro=from_macro, has_body=has_body, \
+                                                 start_offset=start_offset, end_offset=end_offset))
 
-cur.execute('SELECT * FROM macros')
-rows = cur.fetchall()
-for row in rows:
+for row in fetch_rows('macros'):
     f = row[0]
     name = row[1]
     start_line = int(row[2])
     start_col = int(row[3])
     end_line = int(row[4])
     end_col = int(row[5])
+    start_offset = int(row[6]) if len(row) > 7 else None
+    end_offset = int(row[7]) if len(row) > 7 else None
     if not Header.headers.has_key(f):
         Header.headers[f] = Header(f)
     spos = SourcePosition(start_line, start_col)
     epos = SourcePosition(end_line, end_col)
-    Header.headers[f].add_decl_range(SourceRange(spos, epos, name, KIND_MACRO))
+    Header.headers[f].add_decl_range(SourceRange(spos, epos, name, KIND_MACRO, \
+                                                 start_offset=start_offset, end_offset=end_offset))
 
-cur.execute('SELECT * FROM deps')
-rows = cur.fetchall()
-for row in rows:
+for row in fetch_rows('deps'):
     f = row[0]
     included = row[1]
     included_abspath = row[2]
@@ -380,21 +641,22 @@ for row in rows:
 
 # add by wh
 # create table header_comments to store comments from headers
-cur.execute('DROP TABLE IF EXISTS header_comments')
-cur.execute('CREATE TABLE IF NOT EXISTS header_comments (header TEXT NOT NULL, name TEXT, start_line INTEGER, end_line INTEGER, comment TEXT, PRIMARY KEY(header, name, start_line))')
-conn.commit()
+rcur.execute('DROP TABLE IF EXISTS header_comments')
+rcur.execute('CREATE TABLE IF NOT EXISTS header_comments (header TEXT NOT NULL, name TEXT, start_line INTEGER, end_line INTEGER, comment TEXT, PRIMARY KEY(header, name, start_line))')
+results_db.commit()
 
 Header.dumpall()
 
 # Phase 2
 #     Fix compiling errors
 ################################################################################
-def undecl_ident_handler(match):
-    name = match.group(3)
+def add_identifier(name):
     if name.startswith('struct '):
         name = name[7:]
-    cur.execute("SELECT * FROM all_decls WHERE ident = '%s'" % (name))
-    row = cur.fetchone()
+    row = lookup_ident(name)
+    if not row and symbols_cur:
+        symbols_cur.execute('SELECT * FROM all_decls WHERE ident = ?', (name,))
+        row = symbols_cur.fetchone()
     if not row:
         return MSG_HANDLE_FAILED
     f = row[0]
@@ -412,41 +674,139 @@ def undecl_ident_handler(match):
     Header.headers[f].add_decl_range(SourceRange(spos, epos, name, KIND_IDENTIFIER, False))
     return MSG_HANDLE_SUCCEEDED
 
-def skip_handler(match):
-    return MSG_HANDLE_SKIPPED
-
-error_types = []
-error_types.append({
-        'regex': re.compile('^([^:]+):([0-9]+):[0-9]+: error: use of undeclared identifier \'([^\']*)\'.*$'),
-        'handler': undecl_ident_handler})
-error_types.append({
-        'regex': re.compile('([^:]+):([0-9]+):[0-9]+: note: .*'),
-        'handler': skip_handler})
-error_types.append({
-        'regex': re.compile('^In file included from ([^:]+):([0-9]+):$'),
-        'handler': skip_handler})
-error_types.append({
-        'regex': re.compile('^([^:]+):([0-9]+):[0-9]+: error: incomplete definition of type \'([^()]*)\'$'),
-        'handler': undecl_ident_handler})
-error_types.append({
-        'regex': re.compile('^([^:]+):([0-9]+):[0-9]+: error: dereference of pointer to incomplete type \'([^()]*)\'$'),
-        'handler': undecl_ident_handler})
-error_types.append({
-        'regex': re.compile('^([^:]+):([0-9]+):[0-9]+: error: offsetof of incomplete type \'([^()]*)\'$'),
-        'handler': undecl_ident_handler})
-error_types.append({
-        'regex': re.compile('^([^:]+):([0-9]+):[0-9]+: error: variable has incomplete type \'([^()]*)\'$'),
-        'handler': undecl_ident_handler})
-
+# Note: the messages of clang are resolved as the records of HeaderVerifier,
+#       so that the headers come out the same with or without a verifier
 def handle_error_msg(msg):
-    for et in error_types:
-        m = et['regex'].match(msg)
-        if m:
-            return et['handler'](m)
+    return handle_verifier_record(*classify(msg))
 
+def handle_verifier_record(kind, name):
+    if kind == 'missing':
+        return add_identifier(name)
+    if kind == 'note':
+        return MSG_HANDLE_SKIPPED
     return MSG_HANDLE_FAILED
 
+class Verifier:
+    """Resident compiler holding the generated headers in memory, see
+    clang-plugins/verifier/HeaderVerifier.cpp. It reports the identifiers
+    and types a source misses instead of messages to parse."""
+
+    def __init__(self, path, args):
+        self.__p = Popen([path] + args, stdin=PIPE, stdout=PIPE, close_fds=True)
+        # Versions of the headers it holds, by path
+        self.versions = {}
+        self.alive = True
+
+    def update(self, path, content):
+        self.__p.stdin.write('file\t%s\t%d\n' % (path, len(content)))
+        self.__p.stdin.write(content)
+
+    def check(self, source):
+        """(number of errors, [(message, kind, name)]) of compiling @source"""
+        self.__p.stdin.write('check\t%s\n' % source)
+        self.__p.stdin.flush()
+        errors = []
+        while True:
+            line = self.__p.stdout.readline()
+            if not line:
+                raise IOError('verifier exited')
+            kind, name, msg = line.rstrip('\n').split('\t', 2)
+            if kind == 'done':
+                return int(name), errors
+            errors.append((msg, kind, name))
+
+    def close(self):
+        try:
+            if self.alive:
+                self.__p.stdin.write('quit\n')
+            self.__p.stdin.close()
+        except IOError:
+            pass
+        self.__p.wait()
+
+class SourceState:
+    """Progress of a source through the fix rounds"""
+
+    def __init__(self, source, in_memory):
+        self.source = source
+        obj = os.path.splitext(source)[0] + '.o'
+        # Note: the header deps let make rebuild the object only when one of
+        #       the headers it includes was rewritten
+        output_opts = '-o %s -MMD -MP -MF %s.dep' % (obj, obj)
+        self.compile_cmd = ' '.join([clang, clang_opts, output_opts, source])
+        # Checked by a verifier rather than compiled
+        self.in_memory = in_memory
+        # Compiles in memory, its object is yet to be built
+        self.verified = False
+        self.done = False
+        self.exceeded = False
+        self.rounds = 0
+        self.resolved = 0
+        self.retcode = 1
+
+def compile_source(state):
+    """(return code, [(message, None, None)]) of compiling a source on disk"""
+    p = Popen(state.compile_cmd, shell=True, stdin=None, stdout=None, stderr=PIPE, close_fds=True)
+    errors = [line.strip() for line in p.stderr]
+    p.communicate()
+    p.stderr.close()
+    return p.returncode, [(msg, None, None) for msg in errors]
+
+def check_source(state):
+    if state.in_memory:
+        verifier = verifiers.get()
+        try:
+            if verifier.alive:
+                return verifier.check(state.source)
+        except IOError:
+            # e.g. an assertion of clang on the source, which the real
+            # compile may well get past
+            cprint('Warning: verifier exited checking %s, compiling it instead' % state.source, 'yellow')
+            verifier.alive = False
+        finally:
+            verifiers.put(verifier)
+        # Note: dead verifiers stay in the queue, so that no job waits for
+        #       one in vain, but check no more sources
+        state.in_memory = False
+        # The headers on disk lag behind those checked in memory
+        with dump_lock:
+            Header.dumpall()
+    return compile_source(state)
+
+def finish_round(state, retcode, errors):
+    """Resolve the errors of a round of @state. Called in the order of
+    @sources, so that the headers do not depend on the number of jobs."""
+    log = open(os.path.join(logdir, os.path.basename(state.source) + '.' + str(state.rounds + 1)), 'w')
+    state.retcode = retcode
+    if retcode == 0:
+        log.close()
+        if state.in_memory:
+            state.verified = True
+        else:
+            state.done = True
+        return
+
+    abort = True
+    for msg, kind, name in errors:
+        result = handle_error_msg(msg) if kind is None else handle_verifier_record(kind, name)
+        if result == MSG_HANDLE_SUCCEEDED:
+            log.write(msg + '\n')
+            abort = False
+            state.resolved += 1
+        elif result == MSG_HANDLE_FAILED:
+            log.write('*** ' + msg + '\n')
+            abort = False
+    log.close()
+    state.rounds += 1
+    if abort:
+        state.done = True
+    elif state.rounds >= max_rounds:
+        state.done = state.exceeded = True
+
+ledger.finish(stage, headers=len(Header.headers))
+
 print 'Phase 2: Fix compiling errors...'
+stage = ledger.start('phase2')
 
 logdir = os.path.splitext(workdir)[0] + '.log'
 mkdir(logdir)
@@ -462,52 +822,90 @@ clang_opts += ' ' + cc_flags + ' ' + platform_cc_flags
 clang_opts += ' -ferror-limit=100 -Werror -fno-color-diagnostics -fno-diagnostics-fixit-info -fno-caret-diagnostics'
 clang_opts += ' ' + ' '.join(map(lambda x:'-Wno-'+x, clang_ignore_warnings))
 
+# Sources are fixed in synchronized rounds: all sources still failing are
+# compiled concurrently against the same headers, then their errors are
+# resolved in the order of @sources and the headers are written once. So the
+# headers only depend on the sources, not on the number of jobs.
+#
+# Note: verifiers check the sources against the headers in memory, so that
+#       headers are only written once all sources compile, to build the
+#       objects against the final headers
+jobs = max(1, min(args.jobs, len(sources)))
+pool = ThreadPool(jobs)
+verifiers = Queue.Queue()
+dump_lock = threading.Lock()
+if args.verifier:
+    for i in range(jobs):
+        verifiers.put(Verifier(args.verifier, [x for x in shlex.split(clang_opts) if x != '-c']))
+
+# Note: the fix rounds each source needed are kept in the results, so that
+#       gaps in the closure computed by the plugin show up, see 'make fix-rounds'
+rcur.execute('CREATE TABLE IF NOT EXISTS fix_rounds (source TEXT NOT NULL, rounds INTEGER, resolved INTEGER, succeeded INTEGER, PRIMARY KEY(source))')
+
 max_rounds = 10
-succeeded_files = 0
-for source in sources:
-    sys.stdout.write('%s ' % source)
-    sys.stdout.flush()
-    output_opts = '-o ' + os.path.splitext(source)[0] + '.o'
-    compile_cmd = ' '.join([clang, clang_opts, output_opts, source])
-    print compile_cmd
-    rounds = 1
-    abort = False
-    retcode = 1
-    while rounds <= max_rounds and not abort:
-        abort = True
-        resolved = 0
-        log = open(os.path.join(logdir, os.path.basename(source) + '.' + str(rounds)), 'w')
-	p = Popen(compile_cmd, shell=True, stdin=None, stdout=None, stderr=PIPE, close_fds=True)
-        errors = [line.strip() for line in p.stderr]
-        p.communicate()
-        retcode = p.returncode
-        if retcode == 0:
-            # @abort is already set to True. We'll get rid of here at the beginning of next loop
-            continue
-        for msg in errors:
-            result = handle_error_msg(msg)
-            if result == MSG_HANDLE_SUCCEEDED:
-                log.write(msg + '\n')
-                abort = False
-                resolved += 1
-            elif result == MSG_HANDLE_FAILED:
-                log.write('*** ' + msg + '\n')
-                abort = False
-        p.stderr.close()
-        log.close()
+states = [SourceState(source, args.verifier is not None) for source in sources]
+for state in states:
+    print state.compile_cmd
+while True:
+    pending = [state for state in states if not state.done and not state.verified]
+    if not pending:
+        verified = [state for state in states if state.verified]
+        if not verified:
+            break
+        # Build the objects of the sources which compile in memory. Should
+        # the real compile still fail, e.g. in the back end, the source goes
+        # on with the headers on disk.
         Header.dumpall()
-        if rounds % 2 == 1:
-            sys.stdout.write('.')
-            sys.stdout.flush()
-        rounds += 1
+        for state in verified:
+            state.verified = state.in_memory = False
+        pending = verified
+        results = pool.map(compile_source, pending)
     else:
-        if not abort:
-            print 'Max rounds exceeded. Double check error-resolving processes.'
-        elif retcode == 0:
-            cprint(' done in %d rounds' % (rounds - 1), 'green')
-            succeeded_files += 1
-        else:
-            cprint(' failed after %d rounds' % (rounds - 1), 'red')
+        if args.verifier:
+            for verifier in list(verifiers.queue):
+                if not verifier.alive:
+                    continue
+                try:
+                    Header.pushall(verifier)
+                except IOError:
+                    verifier.alive = False
+        results = pool.map(check_source, pending)
+
+    for state, (retcode, errors) in zip(pending, results):
+        finish_round(state, retcode, errors)
+    if [state for state in states if not state.in_memory and not state.done]:
+        Header.dumpall()
+    sys.stdout.write('.')
+    sys.stdout.flush()
+print
+
+succeeded_files = 0
+for state in states:
+    sys.stdout.write('%s ' % state.source)
+    if state.exceeded:
+        print 'Max rounds exceeded. Double check error-resolving processes.'
+    elif state.retcode == 0:
+        cprint(' done in %d rounds' % state.rounds, 'green')
+        succeeded_files += 1
+    else:
+        cprint(' failed after %d rounds' % state.rounds, 'red')
+    rcur.execute('INSERT OR REPLACE INTO fix_rounds VALUES (?, ?, ?, ?)',
+                 (state.source, state.rounds, state.resolved, 1 if state.retcode == 0 else 0))
+results_db.commit()
+
+pool.close()
+while not verifiers.empty():
+    verifiers.get().close()
+# Note: the headers as fixed for sources which failed
+Header.dumpall()
+if verbose:
+    print '%d headers written, %d unchanged' % (Header.written, Header.unchanged)
+    if cache_dir:
+        print '%d headers cached, %d rendered' % (Header.cache_hits, Header.cache_misses)
+# Note: the recompiles of the rounds are accounted to the phase
+ledger.finish(stage, rounds=max([state.rounds for state in states] or [0]),
+              resolved=sum([state.resolved for state in states]),
+              failed=len(sources) - succeeded_files)
 
 if not succeeded_files == len(sources):
     sys.exit(1)
@@ -517,11 +915,8 @@ if not succeeded_files == len(sources):
 print 'Phase 3: Generate dummy implementations...'
 
 class DummyFunc:
-    def __init__(self, name):
+    def __init__(self, name, row):
         self.name = name
-        cur = conn.cursor()
-        cur.execute("SELECT * FROM prototypes WHERE name = '%s'" % name)
-        row = cur.fetchone()
         if not row:
             cprint('Warning: cannot find symbol %s' % name, 'yellow')
             self.proto = ''
@@ -530,6 +925,9 @@ class DummyFunc:
         self.proto = row[1]
         self.header = row[2]
         self.is_function = True if row[3] == 1 else False
+        # Note: the comment attached before the declaration, as recorded by
+        #       DeclFilter
+        self.comment = row[6] or '/*\n */\n'
 
     def generate(self, out):
         if not self.proto:
@@ -537,36 +935,7 @@ class DummyFunc:
 
         # add comment to the dummy file
         if self.header:
-            source_file = open(self.header, 'r')
-            file_lines = source_file.readlines()
-            line_no = 0
-            comment = ''  # to store comments
-            debug = open('debug.txt', 'w+')
-            for tmp in file_lines:
-                if tmp.find(self.name + '(') >= 0:
-                    break
-                line_no += 1
-            if line_no > 0 and file_lines[line_no - 1].find('*/') >= 0:
-                length = 1
-                while file_lines[line_no - length].find('/*') < 0:
-                    length += 1
-                if not file_lines[line_no - length].startswith('/*'):
-                    length = 0
-                    debug.write(self.name + ' ' + self.header)
-                if length > 0:
-                    while length > 0:
-                        comment += file_lines[line_no - length]
-                        out.write(file_lines[line_no - length])
-                        length -= 1
-            else:
-                comment = '/*\n */\n'
-                out.write(comment)
-            # insert the comment to table proto_comments
-            if self.is_function == True:
-                cur.execute("INSERT INTO proto_comments VALUES (?, ?, ?, ?, ?)", (self.name, self.proto, self.header, 1, comment))
-            else:
-                cur.execute("INSERT INTO proto_comments VALUES (?, ?, ?, ?, ?)", (self.name, self.proto, self.header, 0, comment))
-            conn.commit()
+            out.write(self.comment)
 
         if self.proto.startswith('extern'):
             impl = self.proto[7:] + ';\n\n'
@@ -578,36 +947,48 @@ class DummyFunc:
         out.write(impl)
 
 if module_is_dir:
+    stage = ledger.start('link')
     link_cmd = '%sld -r -o %s %s' % (toolchain_prefix, linked, ' '.join(map(lambda x:os.path.join(os.path.splitext(x)[0] + '.o'), sources)))
     p = Popen(link_cmd, shell=True, stdin=None, stdout=None, stderr=None, close_fds=True)
     p.communicate()
+    ledger.finish(stage, returncode=p.returncode)
     if p.returncode != 0:
         print 'Error when linking'
         sys.exit(1)
 
+stage = ledger.start('nm')
 nm_cmd = '%snm %s | grep " U " | sed "s/ *U //g"' % (toolchain_prefix, linked)
 p = Popen(nm_cmd, shell=True, stdin=None, stdout=PIPE, stderr=None, close_fds=True)
 fns = [line.strip() for line in p.stdout]
 p.communicate()
+ledger.finish(stage, returncode=p.returncode, undefined=len(fns))
 if p.returncode != 0:
     print 'Error when fetching undefined symbols'
     sys.exit(1)
 p.stdout.close()
 
+stage = ledger.start('phase3')
 # add by wh
 # call analyze_comments for each of Header.headers
-for k,v in Header.headers.items():
-    v.analyze_comments()
+rcur.executemany('INSERT INTO header_comments VALUES (?, ?, ?, ?, ?)',
+                 (row for v in Header.headers.values() for row in v.analyze_comments()))
 
 # add by wh
 # create table proto_comments for storing comments
-cur.execute('DROP TABLE IF EXISTS proto_comments')
-cur.execute('CREATE TABLE IF NOT EXISTS proto_comments (name TEXT NOT NULL, prototype TEXT, header TEXT, is_function INTEGER, comment TEXT, PRIMARY KEY(name))')
-conn.commit()
+rcur.execute('DROP TABLE IF EXISTS proto_comments')
+rcur.execute('CREATE TABLE IF NOT EXISTS proto_comments (name TEXT NOT NULL, prototype TEXT, header TEXT, is_function INTEGER, comment TEXT, PRIMARY KEY(name))')
+
+# Note: one pass over the prototypes, whose comments come from DeclFilter,
+#       so that no header is read again
+undefined = set(fns)
+protos = {}
+for row in fetch_rows('prototypes'):
+    if row[0] in undefined:
+        protos[row[0]] = row
 
 dummies = []
 for fn in fns:
-    dummies.append(DummyFunc(fn))
+    dummies.append(DummyFunc(fn, protos.get(fn)))
 
 f = open(dummy_out, 'w')
 for header in sorted(set([x for x in map(lambda x:x.header, dummies) if x])):
@@ -616,3 +997,8 @@ f.write('\n#define DDE_WEAK __attribute__((weak))\n\n')
 f.write('#define dde_dummy_printf(...)\n#define dde_printf(...) dde_dummy_printf(__VA_ARGS__)\n\n')
 for dummy in dummies:
     dummy.generate(f)
+f.close()
+rcur.executemany('INSERT INTO proto_comments VALUES (?, ?, ?, ?, ?)',
+                 [(x.name, x.proto, x.header, 1 if x.is_function else 0, x.comment) for x in dummies if x.proto and x.header])
+results_db.commit()
+ledger.finish(stage, dummies=len([x for x in dummies if x.proto]))
@@ -0,0 +1,71 @@
+"""Errors of clang the composer resolves, as records of HeaderVerifier
+
+Phase 2 of the composer fixes the generated headers from the errors of
+compiling the sources. Sources compiled on disk come with the messages of
+clang, which classify() turns into the records HeaderVerifier reports for
+the sources it checks in memory (see clang-plugins/verifier/HeaderVerifier.cpp):
+
+  missing <TAB> <name> <TAB> <message>   undeclared identifiers, unknown
+                                         type names, implicit function decls
+                                         and incomplete types
+  error <TAB> <TAB> <message>
+  note <TAB> <TAB> <message>             notes and include stacks, skipped
+
+Both must resolve the same messages, so that the headers come out the same
+with or without HeaderVerifier. Of the errors naming an incomplete tag,
+HeaderVerifier takes those whose message matches INCOMPLETE_TYPE as well.
+
+Run over the messages of clang, it prints the records HeaderVerifier would,
+which 'make check-verifier' in unittests/ compares.
+
+Usage:
+    clang -fsyntax-only ... 2>&1 | python DeclErrors.py
+"""
+
+import re
+import sys
+
+LOCATION = '^[^:]+:[0-9]+:[0-9]+: '
+
+# Note: the same pattern as incompleteType in HeaderVerifier.cpp
+INCOMPLETE_TYPE = 'incomplete (?:definition of |element |result |return )?type \''
+
+MISSING = [
+    re.compile(LOCATION + 'error: use of undeclared identifier \'([^\']*)\''),
+    re.compile(LOCATION + 'error: unknown type name \'([^\']*)\''),
+    re.compile(LOCATION + 'error: implicit declaration of function \'([^\']*)\''),
+    # Incomplete definitions, dereferences of pointers to and offsetof() of
+    # incomplete types, variables, arrays and results of incomplete types...
+    # The tag is named through typedefs as well, e.g.
+    # 'foo_t' (aka 'struct foo')
+    re.compile(LOCATION + 'error: .*' + INCOMPLETE_TYPE +
+               '(?:[^\']*\' \\(aka \')?(?:const |volatile )*(?:struct|union|enum) ([A-Za-z_][A-Za-z_0-9]*)[ *]*\''),
+]
+
+NOTES = [
+    re.compile(LOCATION + 'note: '),
+    re.compile('^In file included from [^:]+:[0-9]+:$'),
+]
+
+
+def classify(msg):
+    """(kind, name) of the record HeaderVerifier reports for @msg"""
+    for regex in MISSING:
+        m = regex.match(msg)
+        if m:
+            return 'missing', m.group(1)
+    for regex in NOTES:
+        if regex.match(msg):
+            return 'note', ''
+    return 'error', ''
+
+
+def main():
+    for line in sys.stdin:
+        msg = line.rstrip('\n')
+        kind, name = classify(msg)
+        sys.stdout.write('%s\t%s\t%s\n' % (kind, name, msg))
+
+
+if __name__ == '__main__':
+    main()
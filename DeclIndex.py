@@ -0,0 +1,267 @@
+"""Reader and converter of the binary declaration index written by DeclFilter
+
+The layout is described in clang-plugins/common/DeclIndex.h. Rows are
+returned as tuples in the same column order as the tables of the SQLite
+database, so callers can iterate over an index where they used to iterate
+over 'SELECT * FROM <table>'.
+
+Usage:
+    python DeclIndex.py to-sqlite <index> <database>
+    python DeclIndex.py from-sqlite <database> <index>
+"""
+
+import sys
+import mmap
+import struct
+import sqlite3
+import argparse
+
+MAGIC = b'HGDECLIX'
+VERSION = 4
+
+# Sections in file order, with the struct format of their records and the
+# table they correspond to
+SECTION_STRINGS = 0
+SECTIONS = [
+    ('strings', None),
+    ('decls', struct.Struct('=10I')),
+    ('all_decls', struct.Struct('=6I')),
+    ('macros', struct.Struct('=8I')),
+    ('deps', struct.Struct('=5I')),
+    ('prototypes', struct.Struct('=7I')),
+    ('macro_deps', struct.Struct('=4I')),
+]
+
+HEADER = struct.Struct('=8sII')
+SECTION_ENTRY = struct.Struct('=QII')
+
+# Number of columns of each table
+COLUMNS = {
+    'decls': 11,
+    'all_decls': 6,
+    'macros': 8,
+    'deps': 5,
+    'prototypes': 7,
+    'macro_deps': 4,
+}
+
+DECL_FROM_MACRO = 1 << 0
+DECL_HAS_BODY = 1 << 1
+
+# Indexes of string fields in the records of each section
+STRING_FIELDS = {
+    'decls': (0, 1),
+    'all_decls': (0, 1),
+    'macros': (0, 1),
+    'deps': (0, 1, 2),
+    'prototypes': (0, 1, 2, 6),
+    'macro_deps': (0, 1, 2),
+}
+
+# Version of the database schema, kept in PRAGMA user_version. The schema is
+# owned by the plugins (see clang-plugins/common/DeclSchema.h) and mirrored
+# here for the databases built from indexes and shards.
+SCHEMA_VERSION = 3
+
+SCHEMA = {
+    'deps': 'CREATE TABLE IF NOT EXISTS deps (header TEXT NOT NULL, included TEXT NOT NULL, included_path TEXT NOT NULL, line INTEGER, force_keep INTEGER, PRIMARY KEY(header, included)) WITHOUT ROWID',
+    'macros': 'CREATE TABLE IF NOT EXISTS macros (header TEXT NOT NULL, name TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, start_offset INTEGER, end_offset INTEGER, PRIMARY KEY(header, name, start_line)) WITHOUT ROWID',
+    'prototypes': 'CREATE TABLE IF NOT EXISTS prototypes (name TEXT NOT NULL, prototype TEXT, header TEXT, is_function INTEGER, comment_start INTEGER, comment_end INTEGER, comment TEXT, PRIMARY KEY(name)) WITHOUT ROWID',
+    'decls': 'CREATE TABLE IF NOT EXISTS decls (header TEXT NOT NULL, name TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, kind INTEGER, from_macro INTEGER, has_body INTEGER, start_offset INTEGER, end_offset INTEGER, PRIMARY KEY(header, name, start_line, kind)) WITHOUT ROWID',
+    'all_decls': 'CREATE TABLE IF NOT EXISTS all_decls (header TEXT NOT NULL, ident TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, PRIMARY KEY(header, ident, start_line)) WITHOUT ROWID',
+    'macro_deps': 'CREATE TABLE IF NOT EXISTS macro_deps (header TEXT NOT NULL, name TEXT NOT NULL, ident TEXT NOT NULL, kind INTEGER, PRIMARY KEY(header, name, ident)) WITHOUT ROWID',
+    'stats': 'CREATE TABLE IF NOT EXISTS stats (name TEXT NOT NULL, value INTEGER, PRIMARY KEY(name)) WITHOUT ROWID',
+}
+
+# Secondary indexes of each table
+INDEXES = {
+    'deps': ['CREATE INDEX IF NOT EXISTS deps_included_path ON deps (header, included_path)'],
+    'all_decls': ['CREATE INDEX IF NOT EXISTS all_decls_ident ON all_decls (ident)'],
+}
+
+
+def create_tables(cur, tables):
+    """Create @tables with their indexes and stamp the schema version"""
+    for name in tables:
+        cur.execute(SCHEMA[name])
+        for sql in INDEXES.get(name, []):
+            cur.execute(sql)
+    cur.execute('PRAGMA user_version = %d' % SCHEMA_VERSION)
+
+
+def schema_version(conn):
+    return conn.execute('PRAGMA user_version').fetchone()[0]
+
+
+class DeclIndexError(Exception):
+    pass
+
+
+class DeclIndex:
+    def __init__(self, path):
+        self.__file = open(path, 'rb')
+        try:
+            self.__map = mmap.mmap(self.__file.fileno(), 0, access=mmap.ACCESS_READ)
+        except ValueError:
+            raise DeclIndexError('%s: empty file' % path)
+        self.__strings = {}
+
+        if len(self.__map) < HEADER.size + SECTION_ENTRY.size * len(SECTIONS):
+            raise DeclIndexError('%s: truncated index' % path)
+        magic, version, nr_sections = HEADER.unpack_from(self.__map, 0)
+        if magic != MAGIC:
+            raise DeclIndexError('%s: not a declaration index' % path)
+        if version != VERSION or nr_sections != len(SECTIONS):
+            raise DeclIndexError('%s: unsupported index version %d' % (path, version))
+
+        self.__sections = []
+        for i in range(nr_sections):
+            offset, count, record_size = SECTION_ENTRY.unpack_from(self.__map, HEADER.size + i * SECTION_ENTRY.size)
+            fmt = SECTIONS[i][1]
+            if (fmt and record_size != fmt.size) or offset + count * record_size > len(self.__map):
+                raise DeclIndexError('%s: corrupted index' % path)
+            self.__sections.append((offset, count))
+
+    def close(self):
+        self.__map.close()
+        self.__file.close()
+
+    def string(self, offset):
+        s = self.__strings.get(offset)
+        if s is None:
+            base = self.__sections[SECTION_STRINGS][0] + offset
+            s = self.__map[base:self.__map.find(b'\0', base)]
+            # Note: Python 2 keeps the bytes, as the composer reads the
+            #       database with text_factory = str
+            if not isinstance(s, str):
+                s = s.decode('utf-8')
+            self.__strings[offset] = s
+        return s
+
+    def records(self, table):
+        """Iterate over the rows of @table as tuples of table columns"""
+        for i, (name, fmt) in enumerate(SECTIONS):
+            if name == table:
+                break
+        else:
+            raise KeyError(table)
+
+        offset, count = self.__sections[i]
+        strings = STRING_FIELDS[table]
+        for n in range(count):
+            row = list(fmt.unpack_from(self.__map, offset + n * fmt.size))
+            for f in strings:
+                row[f] = self.string(row[f])
+            if table == 'decls':
+                flags = row[7]
+                row[7:8] = [1 if flags & DECL_FROM_MACRO else 0, 1 if flags & DECL_HAS_BODY else 0]
+            yield tuple(row)
+
+    def decls(self):
+        return self.records('decls')
+
+    def all_decls(self):
+        return self.records('all_decls')
+
+    def macros(self):
+        return self.records('macros')
+
+    def deps(self):
+        return self.records('deps')
+
+    def prototypes(self):
+        return self.records('prototypes')
+
+    def macro_deps(self):
+        return self.records('macro_deps')
+
+
+def to_sqlite(index_path, db_path):
+    index = DeclIndex(index_path)
+    conn = sqlite3.connect(db_path)
+    conn.text_factory = str
+    cur = conn.cursor()
+    create_tables(cur, [name for name, fmt in SECTIONS[1:]])
+    for name, fmt in SECTIONS[1:]:
+        cur.executemany('INSERT OR IGNORE INTO %s VALUES (%s)' % (name, ', '.join(['?'] * COLUMNS[name])),
+                        index.records(name))
+    conn.commit()
+    conn.close()
+    index.close()
+
+
+def from_sqlite(db_path, index_path):
+    conn = sqlite3.connect(db_path)
+    conn.text_factory = str
+    cur = conn.cursor()
+
+    strings = bytearray(b'\0')
+    offsets = {'': 0}
+    def string(s):
+        s = s or ''
+        if s not in offsets:
+            offsets[s] = len(strings)
+            strings.extend((s if isinstance(s, bytes) else s.encode('utf-8')) + b'\0')
+        return offsets[s]
+
+    cur.execute("SELECT name FROM sqlite_master WHERE type = 'table'")
+    tables = set(row[0] for row in cur.fetchall())
+
+    sections = [None]
+    for name, fmt in SECTIONS[1:]:
+        data = bytearray()
+        # Note: nor do they have macro_deps
+        if not name in tables:
+            sections.append((data, fmt.size))
+            continue
+        for row in cur.execute('SELECT * FROM %s' % name):
+            # Note: databases written before extents were added lack offsets
+            row = list(row) + [0] * (COLUMNS[name] - len(row))
+            for f in STRING_FIELDS[name]:
+                row[f] = string(row[f])
+            if name == 'decls':
+                flags = (DECL_FROM_MACRO if row[7] else 0) | (DECL_HAS_BODY if row[8] else 0)
+                row = row[:7] + [flags] + row[9:]
+            data.extend(fmt.pack(*[int(x or 0) for x in row]))
+        sections.append((data, fmt.size))
+    sections[SECTION_STRINGS] = (strings, 1)
+    conn.close()
+
+    align = lambda x: (x + 7) & ~7
+    out = bytearray(HEADER.pack(MAGIC, VERSION, len(SECTIONS)))
+    offset = HEADER.size + SECTION_ENTRY.size * len(SECTIONS)
+    entries = []
+    for data, size in sections:
+        offset = align(offset)
+        entries.append((offset, len(data) // size, size))
+        offset += len(data)
+    for e in entries:
+        out.extend(SECTION_ENTRY.pack(*e))
+    for (data, size), e in zip(sections, entries):
+        out.extend(b'\0' * (e[0] - len(out)))
+        out.extend(data)
+
+    f = open(index_path, 'wb')
+    f.write(out)
+    f.close()
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='convert declaration indexes from/to SQLite databases')
+    sub = parser.add_subparsers(dest='command')
+    p = sub.add_parser('to-sqlite', help='export an index as a database')
+    p.add_argument('index')
+    p.add_argument('db')
+    p = sub.add_parser('from-sqlite', help='build an index from a database')
+    p.add_argument('db')
+    p.add_argument('index')
+    args = parser.parse_args()
+
+    try:
+        if args.command == 'to-sqlite':
+            to_sqlite(args.index, args.db)
+        else:
+            from_sqlite(args.db, args.index)
+    except DeclIndexError as e:
+        sys.stderr.write('%s\n' % e)
+        sys.exit(1)
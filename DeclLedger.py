@@ -0,0 +1,229 @@
+"""Timing ledger of the stages generating the headers of a driver
+
+Every stage of a driver's pipeline (the plugin runs, the merge, the phases
+of the composer with their recompiles, 'ld -r' and 'nm', and the final
+compiles) appends one JSON object per line to <driver>.ledger.json:
+
+  run             id of the make invocation ($LEDGER_RUN), so that the
+                  records of the last build can be told from earlier ones
+  driver, stage   e.g. 'virtio', 'phase2'
+  source          the source a per-source stage ran for, if any
+  wall, cpu       seconds
+  max_rss_kb      peak RSS of the stage, see below
+  read_bytes, written_bytes
+                  block I/O, that is without what was served by or left in
+                  the page cache
+  ...             counts of the stage, e.g. 'rounds' of phase2
+
+Commands run by 'exec' are measured by wait4(), so their peak RSS is their
+own. Stages within a process (the composer phases) are measured by
+getrusage() of the process and of the children it waited for; as the kernel
+keeps the peak RSS only, theirs is the peak up to the end of the stage.
+
+Usage:
+    python DeclLedger.py exec -l <ledger> -s <stage> [--source <path>] -- <command>...
+    python DeclLedger.py summary [--json] [--all-runs] <ledger>...
+"""
+
+import os
+import sys
+import time
+import json
+import resource
+import argparse
+from subprocess import Popen
+
+BLOCK_SIZE = 512
+
+
+def driver_of(path):
+    name = os.path.basename(path)
+    if name.endswith('.ledger.json'):
+        name = name[:-len('.ledger.json')]
+    return name
+
+
+class Stage:
+    def __init__(self, name, source, start):
+        self.name = name
+        self.source = source
+        self.start = start
+        # Counts of the stage added to its record
+        self.counts = {}
+
+
+class Ledger:
+    """Appends the records of the stages of a process to @path. A ledger
+    without a path records nothing."""
+
+    def __init__(self, path):
+        self.path = path
+        self.driver = driver_of(path) if path else None
+        self.run = os.environ.get('LEDGER_RUN', '')
+
+    @staticmethod
+    def usage():
+        s = resource.getrusage(resource.RUSAGE_SELF)
+        c = resource.getrusage(resource.RUSAGE_CHILDREN)
+        return (time.time(),
+                s.ru_utime + s.ru_stime + c.ru_utime + c.ru_stime,
+                max(s.ru_maxrss, c.ru_maxrss),
+                (s.ru_inblock + c.ru_inblock) * BLOCK_SIZE,
+                (s.ru_oublock + c.ru_oublock) * BLOCK_SIZE)
+
+    def start(self, name, source=None):
+        return Stage(name, source, Ledger.usage())
+
+    def finish(self, stage, **counts):
+        if not self.path:
+            return
+        end = Ledger.usage()
+        start = stage.start
+        record = {'wall': end[0] - start[0], 'cpu': end[1] - start[1], 'max_rss_kb': end[2],
+                  'read_bytes': end[3] - start[3], 'written_bytes': end[4] - start[4]}
+        record.update(stage.counts)
+        record.update(counts)
+        self.append(stage.name, stage.source, record)
+
+    def append(self, stage, source, record):
+        record['run'] = self.run
+        record['driver'] = self.driver
+        record['stage'] = stage
+        if source:
+            record['source'] = source
+        # Note: stages of a driver run concurrently with 'make -j', a line
+        #       appended in a single write() does not mix with others
+        fd = os.open(self.path, os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0o644)
+        os.write(fd, (json.dumps(record, sort_keys=True) + '\n').encode('utf-8'))
+        os.close(fd)
+
+
+def execute(args):
+    """Run the command and record it, exiting with its status"""
+    start = time.time()
+    p = Popen(args.argv, close_fds=True)
+    pid, status, usage = os.wait4(p.pid, 0)
+    wall = time.time() - start
+    if os.WIFEXITED(status):
+        code = os.WEXITSTATUS(status)
+    else:
+        code = 128 + os.WTERMSIG(status)
+    Ledger(args.ledger).append(args.stage, args.source, {
+        'wall': wall,
+        'cpu': usage.ru_utime + usage.ru_stime,
+        'max_rss_kb': usage.ru_maxrss,
+        'read_bytes': usage.ru_inblock * BLOCK_SIZE,
+        'written_bytes': usage.ru_oublock * BLOCK_SIZE,
+        'returncode': code,
+    })
+    sys.exit(code)
+
+
+def load(path):
+    records = []
+    f = open(path, 'r')
+    for line in f:
+        try:
+            records.append(json.loads(line))
+        except ValueError:
+            # e.g. a line cut short by an interrupted build
+            continue
+    f.close()
+    return records
+
+
+# Columns of the summary, in pipeline order. Stages not listed here are
+# shown after them.
+STAGES = ['plugin', 'merge', 'phase1', 'phase2', 'link', 'nm', 'phase3', 'compile']
+
+
+def summarize(ledgers, all_runs):
+    """{driver: {stage: totals}} of the last run of each driver"""
+    summary = {}
+    for path in ledgers:
+        records = load(path)
+        if not records:
+            continue
+        if not all_runs:
+            last = records[-1].get('run', '')
+            records = [r for r in records if r.get('run', '') == last]
+        stages = {}
+        for r in records:
+            t = stages.setdefault(r['stage'], {'count': 0, 'wall': 0.0, 'cpu': 0.0, 'max_rss_kb': 0,
+                                               'read_bytes': 0, 'written_bytes': 0})
+            t['count'] += 1
+            for k in ['wall', 'cpu', 'read_bytes', 'written_bytes']:
+                t[k] += r.get(k, 0)
+            t['max_rss_kb'] = max(t['max_rss_kb'], r.get('max_rss_kb', 0))
+            for k in ['rounds', 'resolved']:
+                if k in r:
+                    t[k] = max(t.get(k, 0), r[k])
+        summary[records[0].get('driver') or driver_of(path)] = stages
+    return summary
+
+
+def print_summary(summary):
+    stages = [s for s in STAGES if [d for d in summary.values() if s in d]]
+    stages += sorted(set([s for d in summary.values() for s in d if not s in STAGES]))
+    width = max([len(d) for d in summary] + [len('total')]) + 2
+
+    out = sys.stdout
+    out.write('wall time (s)\n')
+    out.write(''.ljust(width) + ''.join([s.rjust(10) for s in stages]) + 'total'.rjust(10) + 'rounds'.rjust(8) + '\n')
+    totals = dict([(s, 0.0) for s in stages])
+    for driver in sorted(summary):
+        d = summary[driver]
+        row = [d[s]['wall'] if s in d else None for s in stages]
+        for s, v in zip(stages, row):
+            totals[s] += v or 0
+        rounds = d.get('phase2', {}).get('rounds')
+        out.write(driver.ljust(width) +
+                  ''.join([('%.2f' % v if v is not None else '-').rjust(10) for v in row]) +
+                  ('%.2f' % sum([v or 0 for v in row])).rjust(10) +
+                  (str(rounds) if rounds is not None else '-').rjust(8) + '\n')
+    out.write('total'.ljust(width) + ''.join([('%.2f' % totals[s]).rjust(10) for s in stages]) +
+              ('%.2f' % sum(totals.values())).rjust(10) + '\n')
+
+    out.write('\npeak RSS (MiB), block I/O read/written (MiB)\n')
+    for driver in sorted(summary):
+        d = summary[driver]
+        peak = max([t['max_rss_kb'] for t in d.values()])
+        read = sum([t['read_bytes'] for t in d.values()])
+        written = sum([t['written_bytes'] for t in d.values()])
+        slowest = max(d, key=lambda s: d[s]['wall'])
+        out.write('%s%8.1f%10.1f%10.1f   slowest: %s\n' % (driver.ljust(width), peak / 1024.0,
+                                                           read / 1048576.0, written / 1048576.0, slowest))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='timing ledger of the header generation pipeline')
+    sub = parser.add_subparsers(dest='command')
+    p = sub.add_parser('exec', help='run a command and record it as a stage')
+    p.add_argument('-l', '--ledger', required=True)
+    p.add_argument('-s', '--stage', required=True)
+    p.add_argument('--source')
+    p.add_argument('argv', nargs=argparse.REMAINDER, metavar='command')
+    p = sub.add_parser('summary', help='aggregate the ledgers of drivers')
+    p.add_argument('--json', action='store_true', help='print the totals as JSON')
+    p.add_argument('--all-runs', action='store_true', help='sum up all runs rather than the last one')
+    p.add_argument('ledgers', nargs='*')
+    args = parser.parse_args()
+
+    if args.command == 'exec':
+        if args.argv and args.argv[0] == '--':
+            args.argv = args.argv[1:]
+        if not args.argv:
+            parser.error('no command to run')
+        execute(args)
+
+    summary = summarize([l for l in args.ledgers if os.path.isfile(l)], args.all_runs)
+    if not summary:
+        sys.stderr.write('no ledgers\n')
+        sys.exit(1)
+    if args.json:
+        sys.stdout.write(json.dumps(summary, sort_keys=True, indent=1) + '\n')
+    else:
+        print_summary(summary)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,131 @@
+"""Content-hash manifests to skip regenerating unchanged outputs
+
+A manifest records the SHA-1 of every input of a step: the files given on
+the command line, every header listed in the deps table of the step's
+database and a string of flags. When the step is about to run again and
+neither the inputs nor the flags changed, its outputs are reused as they are
+and keep their timestamps, so make does not rebuild what depends on them.
+
+Headers whose size and mtime match the manifest are not hashed again.
+
+Usage:
+    python DeclManifest.py check -m <manifest> [--db <db>] [--flags=<flags>]
+                                 [--outputs <path>...] -- <input>...
+    python DeclManifest.py update -m <manifest> [--db <db>] [--flags=<flags>]
+                                  -- <input>...
+
+'check' exits with 0 if the outputs exist and are up to date, 1 otherwise.
+"""
+
+import os
+import sys
+import json
+import sqlite3
+import hashlib
+import argparse
+
+def digest(path):
+    h = hashlib.sha1()
+    f = open(path, 'rb')
+    while True:
+        data = f.read(1 << 16)
+        if not data:
+            break
+        h.update(data)
+    f.close()
+    return h.hexdigest()
+
+def db_headers(db):
+    """Headers the database was computed from"""
+    if not db or not os.path.isfile(db):
+        return []
+    conn = sqlite3.connect(db)
+    try:
+        rows = conn.execute('SELECT DISTINCT included_path FROM deps').fetchall()
+    except sqlite3.Error:
+        rows = []
+    conn.close()
+    return [row[0] for row in rows]
+
+def load(manifest):
+    try:
+        f = open(manifest, 'r')
+        data = json.load(f)
+        f.close()
+        return data
+    except (IOError, ValueError):
+        return None
+
+def stat(path):
+    st = os.stat(path)
+    return [st.st_size, st.st_mtime]
+
+def file_entry(path, old):
+    """[size, mtime, sha1] of @path, reusing the hash of @old if unchanged"""
+    entry = stat(path)
+    if old and old[:2] == entry:
+        return old
+    return entry + [digest(path)]
+
+def flags_digest(flags):
+    return hashlib.sha1((flags or '').encode('utf-8')).hexdigest()
+
+def inputs(db, files):
+    paths = list(files)
+    for header in db_headers(db):
+        if not header in paths:
+            paths.append(header)
+    return paths
+
+def check(manifest, db, flags, outputs, files):
+    data = load(manifest)
+    if not data or data.get('flags') != flags_digest(flags):
+        return False
+    for output in outputs:
+        if not os.path.exists(output):
+            return False
+
+    recorded = data.get('files', {})
+    paths = inputs(db, files)
+    if set(paths) != set(recorded.keys()):
+        return False
+    for path in paths:
+        if not os.path.isfile(path):
+            return False
+        old = recorded[path]
+        if file_entry(path, old)[2] != old[2]:
+            return False
+    return True
+
+def update(manifest, db, flags, files):
+    old = load(manifest) or {}
+    recorded = old.get('files', {})
+    entries = {}
+    for path in inputs(db, files):
+        if os.path.isfile(path):
+            entries[path] = file_entry(path, recorded.get(path))
+
+    tmp = manifest + '.tmp'
+    f = open(tmp, 'w')
+    json.dump({'flags': flags_digest(flags), 'files': entries}, f, sort_keys=True)
+    f.close()
+    os.rename(tmp, manifest)
+
+if __name__ == '__main__':
+    common = argparse.ArgumentParser(add_help=False)
+    common.add_argument('-m', '--manifest', required=True)
+    common.add_argument('--db', help='database whose deps are inputs as well')
+    common.add_argument('--flags', help='flags the outputs depend on, as --flags=<flags>', default='')
+    common.add_argument('inputs', nargs='*')
+
+    parser = argparse.ArgumentParser(description='skip regenerating outputs whose inputs did not change')
+    sub = parser.add_subparsers(dest='command')
+    p = sub.add_parser('check', parents=[common], help='check whether the outputs are up to date')
+    p.add_argument('--outputs', nargs='*', default=[], help='outputs which must exist to be reused')
+    sub.add_parser('update', parents=[common], help='record the inputs of fresh outputs')
+    args = parser.parse_args()
+
+    if args.command == 'check':
+        sys.exit(0 if check(args.manifest, args.db, args.flags, args.outputs, args.inputs) else 1)
+    else:
+        update(args.manifest, args.db, args.flags, args.inputs)
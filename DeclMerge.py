@@ -0,0 +1,93 @@
+"""Merge per-source DeclFilter databases into the database of a module
+
+Each source of a directory module is analysed by its own clang process into
+a shard. Shards are replayed in the order given on the command line, which
+has to be the order the sources would have been passed to a single clang
+invocation, so that the merged database matches what DeclFilter writes when
+it processes all sources serially:
+
+  - rows are unique on the primary keys of the tables, and the first shard
+    providing a row wins like INSERT OR IGNORE does in the plugin;
+  - deps.force_keep is set on every row of a (header, included_path) pair
+    once any shard has entered included_path from header, like the UPDATE
+    the plugin issues on ExitFile;
+  - the counters of traced runs (stats) are added up.
+
+The shards of the kernel-wide symbol database, written by DumpDecls, are
+merged the same way with --tables all_decls.
+
+Usage:
+    python DeclMerge.py [--tables <table>,...] -o <module>.sqlite <shard>...
+"""
+
+import os
+import sys
+import sqlite3
+import argparse
+
+from DeclIndex import SCHEMA_VERSION, create_tables
+
+TABLES = ['decls', 'all_decls', 'macros', 'deps', 'prototypes', 'macro_deps']
+
+def shard_tables(cur):
+    cur.execute("SELECT name FROM shard.sqlite_master WHERE type = 'table'")
+    return set(row[0] for row in cur.fetchall())
+
+def merge(output, shards, tables=TABLES):
+    tmp = output + '.tmp'
+    if os.path.exists(tmp):
+        os.remove(tmp)
+
+    conn = sqlite3.connect(tmp)
+    cur = conn.cursor()
+    create_tables(cur, tables + ['stats'])
+
+    for shard in shards:
+        cur.execute('ATTACH DATABASE ? AS shard', (shard,))
+        version = cur.execute('PRAGMA shard.user_version').fetchone()[0]
+        if version != SCHEMA_VERSION:
+            conn.close()
+            os.remove(tmp)
+            sys.stderr.write('%s: schema version %d, expected %d\n' % (shard, version, SCHEMA_VERSION))
+            sys.exit(1)
+        present = shard_tables(cur)
+        for table in tables:
+            if not table in present:
+                continue
+            if table == 'deps':
+                cur.execute('INSERT OR IGNORE INTO deps SELECT header, included, included_path, line, 0 FROM shard.deps')
+                cur.execute('UPDATE deps SET force_keep = 1 WHERE EXISTS '
+                            '(SELECT 1 FROM shard.deps s WHERE s.force_keep = 1 AND '
+                            's.header = deps.header AND s.included_path = deps.included_path)')
+            else:
+                cur.execute('INSERT OR IGNORE INTO %s SELECT * FROM shard.%s' % (table, table))
+        if 'stats' in present:
+            cur.execute('INSERT OR REPLACE INTO stats SELECT s.name, s.value + COALESCE(m.value, 0) '
+                        'FROM shard.stats s LEFT JOIN main.stats m ON m.name = s.name')
+        conn.commit()
+        cur.execute('DETACH DATABASE shard')
+
+    conn.close()
+    os.rename(tmp, output)
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='merge DeclFilter shards into one database')
+    parser.add_argument('-o', '--output', help='merged database', required=True)
+    parser.add_argument('--tables', help='comma-separated tables to merge (default: %s)' % ','.join(TABLES))
+    parser.add_argument('shards', nargs='+')
+    args = parser.parse_args()
+
+    for shard in args.shards:
+        if not os.path.isfile(shard):
+            sys.stderr.write('%s: no such shard\n' % shard)
+            sys.exit(1)
+
+    tables = TABLES
+    if args.tables:
+        tables = args.tables.split(',')
+        for table in tables:
+            if not table in TABLES:
+                sys.stderr.write('%s: no such table\n' % table)
+                sys.exit(1)
+
+    merge(args.output, args.shards, tables)
@@ -0,0 +1,223 @@
+//===- DeclIndex.cpp ------------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Writer of the binary declaration index.
+//
+//===----------------------------------------------------------------------===//
+
+#include "DeclIndex.h"
+#include "llvm/ADT/SmallString.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+// Indexed by DeclIndexSection
+static const uint32_t recordSizes[NR_SECTIONS] = {
+	1,
+	sizeof(IndexDecl),
+	sizeof(IndexAllDecl),
+	sizeof(IndexMacro),
+	sizeof(IndexDep),
+	sizeof(IndexPrototype),
+	sizeof(IndexMacroDep),
+};
+
+static uint64_t align8(uint64_t offset) {
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+DeclIndexBuilder::DeclIndexBuilder() {
+	// Offset 0 is the empty string
+	strings.push_back('\0');
+}
+
+uint32_t DeclIndexBuilder::addString(llvm::StringRef s) {
+	if (s.empty())
+		return 0;
+
+	llvm::StringMapEntry<uint32_t> &E = stringOffsets.GetOrCreateValue(s);
+	if (!E.getValue()) {
+		E.setValue(strings.size());
+		strings.insert(strings.end(), s.begin(), s.end());
+		strings.push_back('\0');
+	}
+	return E.getValue();
+}
+
+bool DeclIndexBuilder::addKey(char table, llvm::StringRef a, llvm::StringRef b,
+							  int line, int kind) {
+	llvm::SmallString<256> key;
+	key.push_back(table);
+	key.append(a.begin(), a.end());
+	key.push_back('\0');
+	key.append(b.begin(), b.end());
+	key.push_back('\0');
+	key.append((const char *)&line, (const char *)&line + sizeof(line));
+	key.append((const char *)&kind, (const char *)&kind + sizeof(kind));
+
+	llvm::StringMapEntry<char> &E = keys.GetOrCreateValue(key.str());
+	if (E.getValue())
+		return false;
+	E.setValue(1);
+	return true;
+}
+
+bool DeclIndexBuilder::addMacro(llvm::StringRef header, llvm::StringRef name,
+								int startLine, int startColumn, int endLine, int endColumn,
+								int startOffset, int endOffset) {
+	if (!addKey('m', header, name, startLine))
+		return false;
+	IndexMacro r = { addString(header), addString(name),
+					 (uint32_t)startLine, (uint32_t)startColumn, (uint32_t)endLine, (uint32_t)endColumn,
+					 (uint32_t)startOffset, (uint32_t)endOffset };
+	macros.push_back(r);
+	return true;
+}
+
+bool DeclIndexBuilder::addDep(llvm::StringRef header, llvm::StringRef included,
+							  llvm::StringRef includedPath, int line) {
+	if (!addKey('i', header, included))
+		return false;
+	IndexDep r = { addString(header), addString(included), addString(includedPath),
+				   (uint32_t)line, 0 };
+
+	llvm::SmallString<256> key(header);
+	key.push_back('\0');
+	key += includedPath;
+	depsByPath[key.str()].push_back(deps.size());
+	deps.push_back(r);
+	return true;
+}
+
+void DeclIndexBuilder::setForceKeep(llvm::StringRef header, llvm::StringRef includedPath) {
+	llvm::SmallString<256> key(header);
+	key.push_back('\0');
+	key += includedPath;
+
+	llvm::StringMap<llvm::SmallVector<unsigned, 1> >::iterator i = depsByPath.find(key.str());
+	if (i == depsByPath.end())
+		return;
+	for (unsigned j = 0; j < i->second.size(); j++)
+		deps[i->second[j]].forceKeep = 1;
+}
+
+bool DeclIndexBuilder::addDecl(llvm::StringRef header, llvm::StringRef name,
+							   int startLine, int startColumn, int endLine, int endColumn,
+							   int kind, int fromMacro, int hasBody, int startOffset, int endOffset) {
+	if (!addKey('d', header, name, startLine, kind))
+		return false;
+	uint32_t flags = 0;
+	if (fromMacro)
+		flags |= DECL_FROM_MACRO;
+	if (hasBody)
+		flags |= DECL_HAS_BODY;
+	IndexDecl r = { addString(header), addString(name),
+					(uint32_t)startLine, (uint32_t)startColumn, (uint32_t)endLine, (uint32_t)endColumn,
+					(uint32_t)kind, flags, (uint32_t)startOffset, (uint32_t)endOffset };
+	decls.push_back(r);
+	return true;
+}
+
+bool DeclIndexBuilder::addAllDecl(llvm::StringRef header, llvm::StringRef ident,
+								  int startLine, int startColumn, int endLine, int endColumn) {
+	if (!addKey('a', header, ident, startLine))
+		return false;
+	IndexAllDecl r = { addString(header), addString(ident),
+					   (uint32_t)startLine, (uint32_t)startColumn, (uint32_t)endLine, (uint32_t)endColumn };
+	allDecls.push_back(r);
+	return true;
+}
+
+bool DeclIndexBuilder::addPrototype(llvm::StringRef name, llvm::StringRef prototype,
+									llvm::StringRef header, int isFunction,
+									int commentStart, int commentEnd, llvm::StringRef comment) {
+	if (!addKey('p', name))
+		return false;
+	IndexPrototype r = { addString(name), addString(prototype), addString(header),
+						 (uint32_t)isFunction, (uint32_t)commentStart, (uint32_t)commentEnd,
+						 addString(comment) };
+	prototypes.push_back(r);
+	return true;
+}
+
+bool DeclIndexBuilder::addMacroDep(llvm::StringRef header, llvm::StringRef name,
+								   llvm::StringRef ident, int kind) {
+	llvm::SmallString<64> key(name);
+	key.push_back('\0');
+	key += ident;
+	if (!addKey('x', header, key.str()))
+		return false;
+	IndexMacroDep r = { addString(header), addString(name), addString(ident), (uint32_t)kind };
+	macroDeps.push_back(r);
+	return true;
+}
+
+template <typename Record>
+static void setSection(DeclIndexHeader &H, DeclIndexSection s,
+					   const std::vector<Record> &records, uint64_t &offset) {
+	offset = align8(offset);
+	H.sections[s].offset = offset;
+	H.sections[s].count = records.size();
+	H.sections[s].recordSize = recordSizes[s];
+	offset += records.size() * sizeof(Record);
+}
+
+template <typename Record>
+static bool writeSection(FILE *f, const DeclIndexHeader &H, DeclIndexSection s,
+						 const std::vector<Record> &records) {
+	static const char zeros[8] = { 0 };
+	long pos = ftell(f);
+	if (pos < 0 || H.sections[s].offset < (uint64_t)pos)
+		return false;
+	if (fwrite(zeros, 1, H.sections[s].offset - pos, f) != H.sections[s].offset - pos)
+		return false;
+	if (records.empty())
+		return true;
+	return fwrite(&records[0], sizeof(Record), records.size(), f) == records.size();
+}
+
+bool DeclIndexBuilder::write(const std::string &path) const {
+	DeclIndexHeader H;
+	memset(&H, 0, sizeof(H));
+	memcpy(H.magic, DECL_INDEX_MAGIC, sizeof(H.magic));
+	H.version = DECL_INDEX_VERSION;
+	H.nrSections = NR_SECTIONS;
+
+	uint64_t offset = sizeof(H);
+	setSection(H, SECTION_STRINGS, strings, offset);
+	setSection(H, SECTION_DECLS, decls, offset);
+	setSection(H, SECTION_ALL_DECLS, allDecls, offset);
+	setSection(H, SECTION_MACROS, macros, offset);
+	setSection(H, SECTION_DEPS, deps, offset);
+	setSection(H, SECTION_PROTOTYPES, prototypes, offset);
+	setSection(H, SECTION_MACRO_DEPS, macroDeps, offset);
+
+	// Note: written next to @path and renamed, like DeclWriter does with
+	//       databases
+	std::string temp = path + ".tmp";
+	FILE *f = fopen(temp.c_str(), "wb");
+	if (!f)
+		return false;
+
+	bool ok = fwrite(&H, sizeof(H), 1, f) == 1 &&
+		writeSection(f, H, SECTION_STRINGS, strings) &&
+		writeSection(f, H, SECTION_DECLS, decls) &&
+		writeSection(f, H, SECTION_ALL_DECLS, allDecls) &&
+		writeSection(f, H, SECTION_MACROS, macros) &&
+		writeSection(f, H, SECTION_DEPS, deps) &&
+		writeSection(f, H, SECTION_PROTOTYPES, prototypes) &&
+		writeSection(f, H, SECTION_MACRO_DEPS, macroDeps);
+
+	if (fclose(f) != 0 || !ok || rename(temp.c_str(), path.c_str()) != 0) {
+		unlink(temp.c_str());
+		return false;
+	}
+	return true;
+}
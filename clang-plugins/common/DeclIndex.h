@@ -0,0 +1,161 @@
+//===- DeclIndex.h --------------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Binary declaration index, an alternative to the SQLite database written by
+// DeclFilter. The file starts with a DeclIndexHeader describing one section
+// per table. Each section is an array of fixed-width records whose strings
+// are offsets into a NUL-terminated string table, so readers can mmap the
+// file and iterate over the records in place.
+//
+// All integers are stored in host byte order. DeclIndex.py in the top
+// directory reads the same layout, for DeclComposer.py to run from an index
+// alone, and converts it from/to SQLite.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef DECL_INDEX_H
+#define DECL_INDEX_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define DECL_INDEX_MAGIC "HGDECLIX"
+#define DECL_INDEX_VERSION 4
+
+enum DeclIndexSection {
+	SECTION_STRINGS,
+	SECTION_DECLS,
+	SECTION_ALL_DECLS,
+	SECTION_MACROS,
+	SECTION_DEPS,
+	SECTION_PROTOTYPES,
+	SECTION_MACRO_DEPS,
+	NR_SECTIONS
+};
+
+struct DeclIndexSectionEntry {
+	uint64_t offset;		// from the beginning of the file, 8-byte aligned
+	uint32_t count;			// number of records (bytes for SECTION_STRINGS)
+	uint32_t recordSize;
+};
+
+struct DeclIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t nrSections;
+	DeclIndexSectionEntry sections[NR_SECTIONS];
+};
+
+// Flags of IndexDecl
+enum {
+	DECL_FROM_MACRO = 1 << 0,
+	DECL_HAS_BODY = 1 << 1
+};
+
+// Fields named after the columns of the SQLite tables. Strings are offsets
+// into the string table. Extents are [startOffset, endOffset) byte offsets
+// into the header.
+struct IndexDecl {
+	uint32_t header, name;
+	uint32_t startLine, startColumn, endLine, endColumn;
+	uint32_t kind;
+	uint32_t flags;
+	uint32_t startOffset, endOffset;
+};
+
+struct IndexAllDecl {
+	uint32_t header, ident;
+	uint32_t startLine, startColumn, endLine, endColumn;
+};
+
+struct IndexMacro {
+	uint32_t header, name;
+	uint32_t startLine, startColumn, endLine, endColumn;
+	uint32_t startOffset, endOffset;
+};
+
+struct IndexDep {
+	uint32_t header, included, includedPath;
+	uint32_t line;
+	uint32_t forceKeep;
+};
+
+// The comment attached before the decl is [commentStart, commentEnd) of
+// the header, empty if there is none
+struct IndexPrototype {
+	uint32_t name, prototype, header;
+	uint32_t isFunction;
+	uint32_t commentStart, commentEnd, comment;
+};
+
+// Kinds of IndexMacroDep
+enum {
+	MACRO_DEP_DECL,
+	MACRO_DEP_MACRO
+};
+
+// An identifier in the body of the macro @name defined in @header
+struct IndexMacroDep {
+	uint32_t header, name, ident;
+	uint32_t kind;
+};
+
+/// DeclIndexBuilder - Collect records in memory and write them out as an
+/// index. Records are unique on the same keys as the primary keys of the
+/// SQLite tables; duplicates are dropped like INSERT OR IGNORE does, in which
+/// case the add methods return false.
+class DeclIndexBuilder {
+public:
+	DeclIndexBuilder();
+
+	bool addMacro(llvm::StringRef header, llvm::StringRef name,
+				  int startLine, int startColumn, int endLine, int endColumn,
+				  int startOffset, int endOffset);
+	bool addDep(llvm::StringRef header, llvm::StringRef included,
+				llvm::StringRef includedPath, int line);
+	void setForceKeep(llvm::StringRef header, llvm::StringRef includedPath);
+	bool addDecl(llvm::StringRef header, llvm::StringRef name,
+				 int startLine, int startColumn, int endLine, int endColumn,
+				 int kind, int fromMacro, int hasBody, int startOffset, int endOffset);
+	bool addAllDecl(llvm::StringRef header, llvm::StringRef ident,
+					int startLine, int startColumn, int endLine, int endColumn);
+	bool addPrototype(llvm::StringRef name, llvm::StringRef prototype,
+					  llvm::StringRef header, int isFunction,
+					  int commentStart, int commentEnd, llvm::StringRef comment);
+	bool addMacroDep(llvm::StringRef header, llvm::StringRef name,
+					 llvm::StringRef ident, int kind);
+
+	bool write(const std::string &path) const;
+
+private:
+	std::vector<char> strings;
+	llvm::StringMap<uint32_t> stringOffsets;
+	// Primary keys of the records added so far
+	llvm::StringMap<char> keys;
+	// Deps indexed by header and included path, for setForceKeep()
+	llvm::StringMap<llvm::SmallVector<unsigned, 1> > depsByPath;
+
+	std::vector<IndexDecl> decls;
+	std::vector<IndexAllDecl> allDecls;
+	std::vector<IndexMacro> macros;
+	std::vector<IndexDep> deps;
+	std::vector<IndexPrototype> prototypes;
+	std::vector<IndexMacroDep> macroDeps;
+
+	uint32_t addString(llvm::StringRef s);
+	bool addKey(char table, llvm::StringRef a, llvm::StringRef b = llvm::StringRef(),
+				int line = 0, int kind = 0);
+};
+
+#endif /* DECL_INDEX_H */
@@ -0,0 +1,75 @@
+//===- DeclSchema.cpp -----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Tables and indexes shared by DeclFilter and DumpDecls.
+//
+//===----------------------------------------------------------------------===//
+
+#include "DeclSchema.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <sqlite3.h>
+
+// Note: all tables are keyed on text, so they are clustered on their
+//       primary keys (WITHOUT ROWID, SQLite 3.8.2 or later). The indexes
+//       serve the lookups of DeclWriter and of DeclComposer.py.
+struct TableSchema {
+	const char *table;
+	const char *index;
+};
+
+// Indexed by DeclTable
+static const TableSchema schema[NR_DECL_TABLES] = {
+	{ "CREATE TABLE IF NOT EXISTS deps (header TEXT NOT NULL, included TEXT NOT NULL, included_path TEXT NOT NULL, line INTEGER, force_keep INTEGER, PRIMARY KEY(header, included)) WITHOUT ROWID",
+	  "CREATE INDEX IF NOT EXISTS deps_included_path ON deps (header, included_path)" },
+	{ "CREATE TABLE IF NOT EXISTS macros (header TEXT NOT NULL, name TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, start_offset INTEGER, end_offset INTEGER, PRIMARY KEY(header, name, start_line)) WITHOUT ROWID",
+	  NULL },
+	{ "CREATE TABLE IF NOT EXISTS prototypes (name TEXT NOT NULL, prototype TEXT, header TEXT, is_function INTEGER, comment_start INTEGER, comment_end INTEGER, comment TEXT, PRIMARY KEY(name)) WITHOUT ROWID",
+	  NULL },
+	{ "CREATE TABLE IF NOT EXISTS decls (header TEXT NOT NULL, name TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, kind INTEGER, from_macro INTEGER, has_body INTEGER, start_offset INTEGER, end_offset INTEGER, PRIMARY KEY(header, name, start_line, kind)) WITHOUT ROWID",
+	  NULL },
+	{ "CREATE TABLE IF NOT EXISTS all_decls (header TEXT NOT NULL, ident TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, PRIMARY KEY(header, ident, start_line)) WITHOUT ROWID",
+	  "CREATE INDEX IF NOT EXISTS all_decls_ident ON all_decls (ident)" },
+	{ "CREATE TABLE IF NOT EXISTS macro_deps (header TEXT NOT NULL, name TEXT NOT NULL, ident TEXT NOT NULL, kind INTEGER, PRIMARY KEY(header, name, ident)) WITHOUT ROWID",
+	  NULL },
+	{ "CREATE TABLE IF NOT EXISTS stats (name TEXT NOT NULL, value INTEGER, PRIMARY KEY(name)) WITHOUT ROWID",
+	  NULL },
+};
+
+static bool exec(sqlite3 *db, const char *sql) {
+	char *errmsg;
+	if (sqlite3_exec(db, sql, 0, 0, &errmsg) != SQLITE_OK) {
+		llvm::errs() << sql << ": " << errmsg << "\n";
+		sqlite3_free(errmsg);
+		return false;
+	}
+	return true;
+}
+
+bool createDeclTables(sqlite3 *db, llvm::ArrayRef<DeclTable> tables) {
+	bool ok = true;
+	for (unsigned i = 0; i < tables.size(); i++) {
+		const TableSchema &S = schema[tables[i]];
+		ok = exec(db, S.table) && ok;
+		if (S.index)
+			ok = exec(db, S.index) && ok;
+	}
+
+	llvm::SmallString<32> version;
+	llvm::raw_svector_ostream(version) << "PRAGMA user_version = " << DECL_SCHEMA_VERSION;
+	return exec(db, version.c_str()) && ok;
+}
+
+bool createDeclTables(sqlite3 *db) {
+	DeclTable tables[TABLE_STATS];
+	for (int i = 0; i < TABLE_STATS; i++)
+		tables[i] = static_cast<DeclTable>(i);
+	return createDeclTables(db, tables);
+}
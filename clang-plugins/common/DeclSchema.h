@@ -0,0 +1,48 @@
+//===- DeclSchema.h -------------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Schema of the databases written by the plugins: the per-source databases
+// of DeclFilter and the kernel-wide symbol database of DumpDecls, which has
+// the all_decls table only. Both carry DECL_SCHEMA_VERSION in PRAGMA
+// user_version. DeclIndex.py mirrors the schema for the databases built
+// from indexes and shards.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef DECL_SCHEMA_H
+#define DECL_SCHEMA_H
+
+#include "llvm/ADT/ArrayRef.h"
+
+struct sqlite3;
+
+// Bumped whenever a table, column or index changes. Keep SCHEMA_VERSION in
+// DeclIndex.py in sync.
+#define DECL_SCHEMA_VERSION 3
+
+enum DeclTable {
+	TABLE_DEPS,
+	TABLE_MACROS,
+	TABLE_PROTOTYPES,
+	TABLE_DECLS,
+	TABLE_ALL_DECLS,
+	TABLE_MACRO_DEPS,
+	TABLE_STATS,
+	NR_DECL_TABLES
+};
+
+/// createDeclTables - Create @tables with their indexes in @db and stamp
+/// DECL_SCHEMA_VERSION. Returns false if a statement fails.
+bool createDeclTables(sqlite3 *db, llvm::ArrayRef<DeclTable> tables);
+
+/// createDeclTables - Create all tables but stats, which PluginTrace creates
+/// for traced runs only.
+bool createDeclTables(sqlite3 *db);
+
+#endif /* DECL_SCHEMA_H */
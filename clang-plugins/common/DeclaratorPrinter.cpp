@@ -0,0 +1,94 @@
+//===- DeclaratorPrinter.cpp ----------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Declarators printed from types, shared by DeclFilter and DumpDecls.
+//
+//===----------------------------------------------------------------------===//
+
+#include "DeclaratorPrinter.h"
+#include "PluginTrace.h"
+#include "clang/AST/Decl.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+// Stands for the name while a type is printed. Identifiers cannot contain
+// it, so it is found exactly where the name goes.
+static const char PLACEHOLDER[] = "\x01";
+
+DeclaratorPrinter::DeclaratorPrinter(const PrintingPolicy &p)
+	: policy(p) {}
+
+void DeclaratorPrinter::appendDeclarator(llvm::SmallVectorImpl<char> &out, QualType T,
+										 llvm::StringRef name) {
+	if (name.empty()) {
+		llvm::raw_svector_ostream os(out);
+		T.print(os, policy);
+		return;
+	}
+
+	llvm::DenseMap<void *, Spelling>::iterator i = memo.find(T.getAsOpaquePtr());
+	if (i == memo.end()) {
+		std::string s;
+		llvm::raw_string_ostream os(s);
+		T.print(os, policy, PLACEHOLDER);
+		os.flush();
+
+		Spelling spelling;
+		std::string::size_type pos = s.find(PLACEHOLDER[0]);
+		if (pos == std::string::npos) {
+			spelling.before = s + " ";
+		} else {
+			spelling.before = s.substr(0, pos);
+			spelling.after = s.substr(pos + 1);
+		}
+		i = memo.insert(std::make_pair(T.getAsOpaquePtr(), spelling)).first;
+		PluginTrace::get().count("declarators.printed");
+	} else {
+		PluginTrace::get().count("declarators.memoized");
+	}
+
+	out.append(i->second.before.begin(), i->second.before.end());
+	out.append(name.begin(), name.end());
+	out.append(i->second.after.begin(), i->second.after.end());
+}
+
+llvm::StringRef DeclaratorPrinter::printDeclarator(QualType T, llvm::StringRef name) {
+	buffer.clear();
+	appendDeclarator(buffer, T, name);
+	return buffer.str();
+}
+
+llvm::StringRef DeclaratorPrinter::printPrototype(const FunctionDecl *FD) {
+	// Note: the name and parameters are the declarator of the result type
+	scratch.clear();
+	scratch += FD->getNameAsString();
+	scratch += '(';
+	char pn[2] = "a";
+	for (unsigned i = 0, e = FD->getNumParams(); i < e; i++) {
+		if (i)
+			scratch += ", ";
+		pn[0] = 'a' + i;
+		appendDeclarator(scratch, FD->getParamDecl(i)->getOriginalType(), pn);
+	}
+	if (FD->isVariadic())
+		scratch += FD->getNumParams() ? ", ..." : "...";
+	scratch += ')';
+
+	buffer.clear();
+	appendDeclarator(buffer, FD->getResultType(), scratch.str());
+	return buffer.str();
+}
+
+llvm::StringRef DeclaratorPrinter::printExtern(const VarDecl *VD) {
+	buffer.clear();
+	buffer += "extern ";
+	appendDeclarator(buffer, VD->getType(), VD->getNameAsString());
+	return buffer.str();
+}
@@ -0,0 +1,67 @@
+//===- DeclaratorPrinter.h ------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Prints named declarators, prototypes and extern declarations for both
+// plugins. Names are placed by clang's type printer rather than by searching
+// the spelling of the type, so function pointers returning function
+// pointers, arrays of pointers and typeof() come out right.
+//
+// Each type is printed once per translation unit: its spelling is memoized
+// as the text before and after the name. The memo is keyed on the type as
+// written, as keying it on canonical types would lose the typedefs.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef DECLARATOR_PRINTER_H
+#define DECLARATOR_PRINTER_H
+
+#include "clang/AST/PrettyPrinter.h"
+#include "clang/AST/Type.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+
+namespace clang {
+class FunctionDecl;
+class VarDecl;
+}
+
+class DeclaratorPrinter {
+public:
+	explicit DeclaratorPrinter(const clang::PrintingPolicy &policy);
+
+	/// appendDeclarator - Append the declarator of @name of type @T to @out,
+	/// e.g. 'int (*name)(int)'. An empty @name prints the type only.
+	void appendDeclarator(llvm::SmallVectorImpl<char> &out, clang::QualType T,
+						  llvm::StringRef name);
+
+	/// printDeclarator - As appendDeclarator(), into a buffer reused by the
+	/// next call.
+	llvm::StringRef printDeclarator(clang::QualType T, llvm::StringRef name);
+	/// printPrototype - The prototype of @FD, with its parameters named a,
+	/// b, c...
+	llvm::StringRef printPrototype(const clang::FunctionDecl *FD);
+	/// printExtern - The extern declaration of @VD.
+	llvm::StringRef printExtern(const clang::VarDecl *VD);
+
+private:
+	// The spelling of a type around the name of a declarator
+	struct Spelling {
+		std::string before, after;
+	};
+
+	clang::PrintingPolicy policy;
+	llvm::DenseMap<void *, Spelling> memo;
+	llvm::SmallString<256> buffer;
+	llvm::SmallString<128> scratch;
+};
+
+#endif /* DECLARATOR_PRINTER_H */
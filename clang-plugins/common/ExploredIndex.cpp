@@ -0,0 +1,297 @@
+//===- ExploredIndex.cpp --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Persistent hashed set of the declarations dumped by DumpDecls.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ExploredIndex.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t MIN_SLOTS = 1024;
+// Bits of the Bloom filter per slot. Tables are at most half full, so this
+// is 16 bits or more per key, which with 4 hashes sends less than 0.3% of
+// the absent keys on to the table.
+static const uint32_t BLOOM_BITS_PER_SLOT = 8;
+static const unsigned BLOOM_HASHES = 4;
+
+static uint64_t fnv1a(uint64_t h, llvm::StringRef s) {
+	for (unsigned i = 0; i < s.size(); i++) {
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/// hashKey - FNV-1a of @a followed by @b, and the finalizer of MurmurHash3
+/// to spread the bits over both the Bloom filter and the table.
+static uint64_t hashKey(llvm::StringRef a, llvm::StringRef b) {
+	uint64_t h = fnv1a(fnv1a(14695981039346656037ULL, a), b);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	// Note: 0 marks empty slots, ~0 and ~0 - 1 are the empty and tombstone
+	//       keys of DenseSet
+	if (h == 0 || h >= ~0ULL - 1)
+		h = 1;
+	return h;
+}
+
+static size_t fileSize(uint32_t bloomWords, uint32_t nrSlots) {
+	return sizeof(ExploredIndexHeader) + ((size_t)bloomWords + nrSlots) * sizeof(uint64_t);
+}
+
+static uint64_t *bloomOf(const ExploredIndexHeader *H) {
+	return (uint64_t *)(H + 1);
+}
+
+static uint64_t *slotsOf(const ExploredIndexHeader *H) {
+	return bloomOf(H) + H->bloomWords;
+}
+
+static bool isValid(const char *base, size_t size) {
+	if (size < sizeof(ExploredIndexHeader))
+		return false;
+	const ExploredIndexHeader *H = (const ExploredIndexHeader *)base;
+	return !memcmp(H->magic, EXPLORED_INDEX_MAGIC, sizeof(H->magic)) &&
+		H->version == EXPLORED_INDEX_VERSION &&
+		H->bloomWords && !(H->bloomWords & (H->bloomWords - 1)) &&
+		H->nrSlots && !(H->nrSlots & (H->nrSlots - 1)) &&
+		fileSize(H->bloomWords, H->nrSlots) == size;
+}
+
+/// bloomBit - The @i-th bit of @h in a filter of @words words, by double
+/// hashing.
+static uint64_t bloomBit(uint32_t words, uint64_t h, unsigned i) {
+	return (h + i * ((h >> 32) | 1)) & ((uint64_t)words * 64 - 1);
+}
+
+static bool find(const ExploredIndexHeader *H, uint64_t h) {
+	const uint64_t *bloom = bloomOf(H);
+	for (unsigned i = 0; i < BLOOM_HASHES; i++) {
+		uint64_t b = bloomBit(H->bloomWords, h, i);
+		if (!(bloom[b / 64] & (1ULL << (b % 64))))
+			return false;
+	}
+
+	const uint64_t *slots = slotsOf(H);
+	uint32_t mask = H->nrSlots - 1;
+	for (uint32_t i = h & mask; slots[i]; i = (i + 1) & mask)
+		if (slots[i] == h)
+			return true;
+	return false;
+}
+
+/// add - Add @h to the table of @H, which must have an empty slot left.
+static void add(ExploredIndexHeader *H, uint64_t h) {
+	uint64_t *bloom = bloomOf(H);
+	for (unsigned i = 0; i < BLOOM_HASHES; i++) {
+		uint64_t b = bloomBit(H->bloomWords, h, i);
+		bloom[b / 64] |= 1ULL << (b % 64);
+	}
+
+	uint64_t *slots = slotsOf(H);
+	uint32_t mask = H->nrSlots - 1;
+	uint32_t i = h & mask;
+	for (; slots[i]; i = (i + 1) & mask)
+		if (slots[i] == h)
+			return;
+	slots[i] = h;
+	H->count++;
+}
+
+ExploredIndex::ExploredIndex()
+	: base(NULL), size(0) {}
+
+ExploredIndex::~ExploredIndex() {
+	close();
+}
+
+bool ExploredIndex::open(const std::string &p) {
+	close();
+	path = p;
+	if (!map()) {
+		path.clear();
+		return false;
+	}
+	return true;
+}
+
+void ExploredIndex::close() {
+	unmap();
+	path.clear();
+	pending.clear();
+	pendingSet.clear();
+}
+
+bool ExploredIndex::map() {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return errno == ENOENT;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		::close(fd);
+		return false;
+	}
+	if (st.st_size == 0) {
+		::close(fd);
+		return true;
+	}
+
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		return false;
+	// Note: a corrupted index is empty until flush() rebuilds it
+	if (!isValid((const char *)p, st.st_size)) {
+		munmap(p, st.st_size);
+		return true;
+	}
+	base = (const char *)p;
+	size = st.st_size;
+	return true;
+}
+
+void ExploredIndex::unmap() {
+	if (base)
+		munmap((void *)base, size);
+	base = NULL;
+	size = 0;
+}
+
+bool ExploredIndex::contains(uint64_t h) const {
+	if (pendingSet.count(h))
+		return true;
+	return base && find((const ExploredIndexHeader *)base, h);
+}
+
+bool ExploredIndex::insert(llvm::StringRef location, llvm::StringRef name) {
+	uint64_t h = hashKey(location, name);
+	if (contains(h))
+		return false;
+	pending.push_back(h);
+	pendingSet.insert(h);
+	return true;
+}
+
+/// rebuild - Write a table holding the keys of @old, if any, and @keys to
+/// @path, sized so that it is at most a quarter full.
+static bool rebuild(const std::string &path, const ExploredIndexHeader *old,
+					const std::vector<uint64_t> &keys) {
+	uint32_t count = keys.size() + (old ? old->count : 0);
+	uint32_t nrSlots = MIN_SLOTS;
+	while (nrSlots < count * 4)
+		nrSlots *= 2;
+	uint32_t bloomWords = nrSlots * BLOOM_BITS_PER_SLOT / 64;
+	size_t newSize = fileSize(bloomWords, nrSlots);
+
+	std::string temp = path + ".tmp";
+	int fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, newSize) < 0) {
+		::close(fd);
+		unlink(temp.c_str());
+		return false;
+	}
+	void *p = mmap(NULL, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) {
+		unlink(temp.c_str());
+		return false;
+	}
+
+	ExploredIndexHeader *H = (ExploredIndexHeader *)p;
+	memcpy(H->magic, EXPLORED_INDEX_MAGIC, sizeof(H->magic));
+	H->version = EXPLORED_INDEX_VERSION;
+	H->bloomWords = bloomWords;
+	H->nrSlots = nrSlots;
+	H->count = 0;
+	if (old) {
+		const uint64_t *slots = slotsOf(old);
+		for (uint32_t i = 0; i < old->nrSlots; i++)
+			if (slots[i])
+				add(H, slots[i]);
+	}
+	for (unsigned i = 0; i < keys.size(); i++)
+		add(H, keys[i]);
+
+	bool ok = munmap(p, newSize) == 0;
+	if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+		unlink(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool ExploredIndex::flush() {
+	if (path.empty() || pending.empty())
+		return true;
+
+	// Note: runs over the same tree share the index, and one of them may
+	//       have replaced the file while we waited for the lock
+	int fd;
+	struct stat st;
+	for (;;) {
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+			return false;
+		struct stat current;
+		if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0) {
+			::close(fd);
+			return false;
+		}
+		if (stat(path.c_str(), &current) == 0 &&
+			current.st_dev == st.st_dev && current.st_ino == st.st_ino)
+			break;
+		::close(fd);
+	}
+
+	ExploredIndexHeader *H = NULL;
+	if (st.st_size) {
+		void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED && isValid((const char *)p, st.st_size))
+			H = (ExploredIndexHeader *)p;
+		else if (p != MAP_FAILED)
+			munmap(p, st.st_size);
+	}
+
+	bool ok = true;
+	if (H && ((uint64_t)H->count + pending.size()) * 2 <= H->nrSlots) {
+		// Append in place
+		for (unsigned i = 0; i < pending.size(); i++)
+			add(H, pending[i]);
+	} else {
+		// Note: a corrupted index is dropped rather than kept in the way
+		ok = rebuild(path, H, pending);
+	}
+
+	if (H)
+		munmap(H, st.st_size);
+	::close(fd);
+	if (!ok)
+		return false;
+
+	pending.clear();
+	pendingSet.clear();
+	unmap();
+	return map();
+}
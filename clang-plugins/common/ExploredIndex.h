@@ -0,0 +1,81 @@
+//===- ExploredIndex.h ----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Persistent set of the declarations DumpDecls has already dumped, shared by
+// all runs over a source tree. Keys are hashed to 64 bits and kept in an
+// open-addressing table behind a Bloom filter:
+//
+//   ExploredIndexHeader
+//   uint64_t bloom[bloomWords]
+//   uint64_t slots[nrSlots]     0 for an empty slot
+//
+// The file is mapped read-only and probed in place, so startup does not
+// depend on its size. Keys added by a run are kept in memory and appended
+// to the table under an exclusive lock by flush(); the table is rebuilt
+// twice as large into a new file when it gets half full.
+//
+// All integers are stored in host byte order.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EXPLORED_INDEX_H
+#define EXPLORED_INDEX_H
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define EXPLORED_INDEX_MAGIC "HGEXPLRD"
+#define EXPLORED_INDEX_VERSION 1
+
+struct ExploredIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t bloomWords;		// power of 2
+	uint32_t nrSlots;			// power of 2
+	uint32_t count;
+};
+
+class ExploredIndex {
+public:
+	ExploredIndex();
+	~ExploredIndex();
+
+	/// open - Map the index at @path. A missing or corrupted file is an
+	/// empty index, (re)created by the first flush().
+	bool open(const std::string &path);
+	void close();
+	bool isOpen() const { return !path.empty(); }
+
+	/// insert - Add the key @location followed by @name, which are hashed
+	/// without being concatenated. Returns false if it was added before, by
+	/// this run or an earlier one.
+	bool insert(llvm::StringRef location, llvm::StringRef name = llvm::StringRef());
+
+	/// flush - Append the keys inserted since the last flush to the file.
+	bool flush();
+
+private:
+	std::string path;
+	const char *base;
+	size_t size;
+
+	// Keys inserted since the last flush, in order
+	std::vector<uint64_t> pending;
+	llvm::DenseSet<uint64_t> pendingSet;
+
+	bool map();
+	void unmap();
+	bool contains(uint64_t hash) const;
+};
+
+#endif /* EXPLORED_INDEX_H */
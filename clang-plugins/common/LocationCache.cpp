@@ -0,0 +1,100 @@
+//===- LocationCache.cpp --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Per-FileID cache of file names and simplified paths.
+//
+//===----------------------------------------------------------------------===//
+
+#include "LocationCache.h"
+#include "clang/Basic/FileManager.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemoryBuffer.h"
+using namespace clang;
+
+std::string simplifyPath(llvm::StringRef path) {
+	if (path.find("/../") == llvm::StringRef::npos)
+		return path.str();
+
+	llvm::SmallVector<llvm::StringRef, 16> components;
+	llvm::SmallVector<llvm::StringRef, 16> result;
+	path.split(components, "/");
+	for (unsigned i = 0; i < components.size(); i++) {
+		llvm::StringRef c = components[i];
+		if (c == ".." && !result.empty() && result.back() != "..") {
+			// Note: '..' at the root is the root itself
+			if (!result.back().empty())
+				result.pop_back();
+			continue;
+		}
+		result.push_back(c);
+	}
+
+	std::string simplified;
+	simplified.reserve(path.size());
+	for (unsigned i = 0; i < result.size(); i++) {
+		if (i)
+			simplified += '/';
+		simplified += result[i];
+	}
+	return simplified;
+}
+
+llvm::StringRef LocationCache::intern(llvm::StringRef s) {
+	return strings.GetOrCreateValue(s).getKey();
+}
+
+const LocationCache::FileInfo &LocationCache::lookup(FileID FID) {
+	int key = static_cast<int>(FID.getHashValue());
+	llvm::DenseMap<int, FileInfo>::iterator i = files.find(key);
+	if (i != files.end())
+		return i->second;
+
+	FileInfo info;
+	info.isFile = false;
+
+	bool invalid = false;
+	const SrcMgr::SLocEntry &E = SM.getSLocEntry(FID, &invalid);
+	if (!invalid && E.isFile()) {
+		if (const FileEntry *FE = E.getFile().getContentCache()->OrigEntry) {
+			info.name = FE->getName();
+			info.isFile = true;
+		} else {
+			info.name = intern(SM.getBuffer(FID)->getBufferIdentifier());
+		}
+		info.path = intern(simplifyPath(info.name));
+	}
+
+	return files[key] = info;
+}
+
+llvm::StringRef LocationCache::getFilename(SourceLocation Loc) {
+	if (Loc.isInvalid())
+		return llvm::StringRef();
+	const FileInfo &info = lookup(SM.getFileID(Loc));
+	return info.isFile ? info.name : llvm::StringRef();
+}
+
+FileLocation LocationCache::getExpansionLoc(SourceLocation Loc) {
+	FileLocation L;
+	L.isFile = false;
+	L.offset = L.line = L.column = 0;
+	if (Loc.isInvalid())
+		return L;
+
+	std::pair<FileID, unsigned> decomposed = SM.getDecomposedExpansionLoc(Loc);
+	const FileInfo &info = lookup(decomposed.first);
+	L.fid = decomposed.first;
+	L.name = info.name;
+	L.path = info.path;
+	L.isFile = info.isFile;
+	L.offset = decomposed.second;
+	L.line = SM.getLineNumber(decomposed.first, decomposed.second);
+	L.column = SM.getColumnNumber(decomposed.first, decomposed.second);
+	return L;
+}
@@ -0,0 +1,84 @@
+//===- LocationCache.h ----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Per-FileID cache of file names and simplified paths shared by the plugins,
+// so that resolving the location of a macro or decl costs one decomposition
+// and no string allocation.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LOCATION_CACHE_H
+#define LOCATION_CACHE_H
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+/// simplifyPath - Simplify paths like aaa/xxx/../bbb to aaa/bbb.
+std::string simplifyPath(llvm::StringRef path);
+
+/// FileLocation - A location decomposed into its file, line and column.
+struct FileLocation {
+	clang::FileID fid;
+	/// Name of the file or buffer (e.g. <built-in>), as printed by clang
+	llvm::StringRef name;
+	/// @name with '..' components removed
+	llvm::StringRef path;
+	/// Whether the location is in a real file rather than a builtin buffer
+	bool isFile;
+	unsigned offset;
+	unsigned line;
+	unsigned column;
+
+	bool isValid() const { return !fid.isInvalid(); }
+};
+
+class LocationCache {
+public:
+	explicit LocationCache(const clang::SourceManager &sm) : SM(sm) {}
+
+	/// getFilename - Same as SourceManager::getFilename(), i.e. the name of
+	/// the file @Loc is spelled in, or an empty string if it is not in a file.
+	llvm::StringRef getFilename(clang::SourceLocation Loc);
+
+	/// getName - The name of the file entry or buffer of @FID.
+	llvm::StringRef getName(clang::FileID FID) { return lookup(FID).name; }
+
+	/// getPath - The simplified path of @FID.
+	llvm::StringRef getPath(clang::FileID FID) { return lookup(FID).path; }
+
+	/// getExpansionLoc - Decompose the expansion location of @Loc.
+	FileLocation getExpansionLoc(clang::SourceLocation Loc);
+
+	/// getLineNumber - Expansion line of @Loc.
+	unsigned getLineNumber(clang::SourceLocation Loc) {
+		return getExpansionLoc(Loc).line;
+	}
+
+private:
+	struct FileInfo {
+		llvm::StringRef name;
+		llvm::StringRef path;
+		bool isFile;
+	};
+
+	const clang::SourceManager &SM;
+	// Keyed on FileID::getHashValue(). Loaded FileIDs are negative, so
+	// keep the key signed to stay clear of DenseMap's reserved keys.
+	llvm::DenseMap<int, FileInfo> files;
+	// Owns the simplified paths referred to by @files
+	llvm::StringMap<char> strings;
+
+	const FileInfo &lookup(clang::FileID FID);
+	llvm::StringRef intern(llvm::StringRef s);
+};
+
+#endif /* LOCATION_CACHE_H */
@@ -0,0 +1,133 @@
+//===- PluginTrace.cpp ----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Counters and Chrome trace events of the plugins.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PluginTrace.h"
+#include "DeclSchema.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/TimeValue.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <unistd.h>
+
+PluginTrace &PluginTrace::get() {
+	static PluginTrace trace;
+	return trace;
+}
+
+void PluginTrace::open(llvm::StringRef p, llvm::StringRef c) {
+	path = p;
+	category = c;
+	enabled = true;
+}
+
+uint64_t PluginTrace::now() const {
+	llvm::sys::TimeValue T = llvm::sys::TimeValue::now();
+	return T.toEpochTime() * 1000000 + T.microseconds();
+}
+
+void PluginTrace::complete(llvm::StringRef name, uint64_t start, llvm::StringRef detail) {
+	Event E;
+	E.name = name;
+	E.detail = detail;
+	E.start = start;
+	E.duration = now() - start;
+	events.push_back(E);
+
+	llvm::SmallString<32> counter("time.");
+	counter += name;
+	counters[counter.str()] += E.duration;
+}
+
+static void writeString(llvm::raw_ostream &OS, llvm::StringRef s) {
+	OS << '"';
+	for (unsigned i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			OS << '\\' << c;
+		else if (c < 0x20)
+			OS << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+		else
+			OS << c;
+	}
+	OS << '"';
+}
+
+void PluginTrace::close() {
+	if (!enabled)
+		return;
+	enabled = false;
+
+	std::string error;
+	llvm::raw_fd_ostream OS(path.c_str(), error);
+	if (!error.empty()) {
+		llvm::errs() << "cannot write trace " << path << ": " << error << "\n";
+		return;
+	}
+
+	int pid = getpid();
+	OS << "{\"traceEvents\":[\n";
+	for (unsigned i = 0; i < events.size(); i++) {
+		const Event &E = events[i];
+		OS << "{\"name\":";
+		writeString(OS, E.name);
+		OS << ",\"cat\":";
+		writeString(OS, category);
+		OS << ",\"ph\":\"X\",\"ts\":" << E.start << ",\"dur\":" << E.duration
+		   << ",\"pid\":" << pid << ",\"tid\":0";
+		if (!E.detail.empty()) {
+			OS << ",\"args\":{\"detail\":";
+			writeString(OS, E.detail);
+			OS << "}";
+		}
+		OS << "},\n";
+	}
+
+	// Counters as of the end of the run
+	OS << "{\"name\":\"counters\",\"cat\":";
+	writeString(OS, category);
+	OS << ",\"ph\":\"C\",\"ts\":" << now() << ",\"pid\":" << pid << ",\"tid\":0,\"args\":{";
+	for (llvm::StringMap<uint64_t>::const_iterator i = counters.begin(), e = counters.end(); i != e; i++) {
+		if (i != counters.begin())
+			OS << ",";
+		writeString(OS, i->getKey());
+		OS << ":" << i->getValue();
+	}
+	OS << "}}\n]}\n";
+
+	events.clear();
+	counters.clear();
+}
+
+void PluginTrace::writeStats(sqlite3 *db) {
+	if (!enabled || !db)
+		return;
+
+	DeclTable table = TABLE_STATS;
+	if (!createDeclTables(db, table))
+		return;
+
+	// Note: add up the counters of all translation units written to @db
+	sqlite3_stmt *stmt;
+	if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO stats VALUES (?1, ?2 + COALESCE((SELECT value FROM stats WHERE name = ?1), 0))",
+						   -1, &stmt, NULL) != SQLITE_OK) {
+		llvm::errs() << "stats: " << sqlite3_errmsg(db) << "\n";
+		return;
+	}
+	for (llvm::StringMap<uint64_t>::const_iterator i = counters.begin(), e = counters.end(); i != e; i++) {
+		sqlite3_reset(stmt);
+		sqlite3_bind_text(stmt, 1, i->getKey().data(), i->getKey().size(), SQLITE_TRANSIENT);
+		sqlite3_bind_int64(stmt, 2, i->getValue());
+		sqlite3_step(stmt);
+	}
+	sqlite3_finalize(stmt);
+}
@@ -0,0 +1,87 @@
+//===- PluginTrace.h ------------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Instrumentation shared by the plugins. Once enabled by a plugin argument,
+// the plugins count events (preprocessor callbacks, rows inserted or
+// deduplicated, type nodes walked...) and time their phases. Timings are
+// written as a Chrome trace-event JSON file (load it in chrome://tracing),
+// counters and total durations are stored in the 'stats' table of the
+// plugin's database. When disabled, every call returns right away.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef PLUGIN_TRACE_H
+#define PLUGIN_TRACE_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+class PluginTrace {
+public:
+	/// get - The trace of this plugin.
+	static PluginTrace &get();
+
+	/// open - Enable tracing. Events are written to @path by close().
+	void open(llvm::StringRef path, llvm::StringRef category);
+	void close();
+	bool isEnabled() const { return enabled; }
+
+	void count(llvm::StringRef counter, uint64_t n = 1) {
+		if (enabled)
+			counters[counter] += n;
+	}
+
+	/// now - Microseconds since the epoch.
+	uint64_t now() const;
+	/// complete - Record an event @name which started at @start and ends
+	/// now. Its duration is added to the 'time.<name>' counter as well.
+	void complete(llvm::StringRef name, uint64_t start,
+				  llvm::StringRef detail = llvm::StringRef());
+
+	/// writeStats - Store the counters into the 'stats' table of @db.
+	void writeStats(sqlite3 *db);
+
+private:
+	struct Event {
+		std::string name;
+		std::string detail;
+		uint64_t start;
+		uint64_t duration;
+	};
+
+	bool enabled;
+	std::string path;
+	std::string category;
+	std::vector<Event> events;
+	llvm::StringMap<uint64_t> counters;
+
+	PluginTrace() : enabled(false) {}
+};
+
+/// TraceScope - Record an event lasting as long as the scope.
+class TraceScope {
+	PluginTrace &trace;
+	const char *name;
+	uint64_t start;
+
+public:
+	TraceScope(PluginTrace &t, const char *n)
+		: trace(t), name(n), start(t.isEnabled() ? t.now() : 0) {}
+	~TraceScope() {
+		if (trace.isEnabled())
+			trace.complete(name, start);
+	}
+};
+
+#endif /* PLUGIN_TRACE_H */
@@ -14,59 +14,116 @@
 #include "clang/Frontend/FrontendPluginRegistry.h"
 #include "clang/AST/AST.h"
 #include "clang/AST/ASTConsumer.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/AST/TypeVisitor.h"
 #include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/raw_ostream.h"
 using namespace clang;
 
-#include <cstdarg>
 #include <cstdlib>
 #include <cstdio>
 #include <vector>
-#include <list>
-#include <map>
-#include <sqlite3.h>
+
+#include "DeclaratorPrinter.h"
+#include "DeclWriter.h"
+#include "LocationCache.h"
+#include "PluginTrace.h"
+#include "SourceExtent.h"
 
 #define out llvm::outs() << ">>> "
-static const int BUF_SIZE = 1024;
 
-static sqlite3 *conn;
-static char sqlbuf[BUF_SIZE];
-static char *sqlerrmsg;
+static DeclWriter writer;
+static PluginTrace &trace = PluginTrace::get();
 
 static StringRef currentFile, nextFile;
 
-void executeSql(const char *format, ...) {
-	if (!conn)
-		return;
+// Identifiers in the bodies of the macros imported from the prefix database
+static std::vector<DeclWriter::MacroDep> prefixMacroDeps;
 
-	va_list ap;
-	va_start(ap, format);
-	vsnprintf(sqlbuf, BUF_SIZE, format, ap);
-	va_end(ap);
-	sqlite3_exec(conn, sqlbuf, 0, 0, &sqlerrmsg);
-	// if (sqlite3_exec(conn, sqlbuf, 0, 0, &sqlerrmsg) != SQLITE_OK)
-	// 	out << sqlbuf << ": " << sqlerrmsg << "\n";
-}
+// Headers whose decls are looked up in the kernel-wide symbol database
+// rather than in all_decls
+static llvm::StringSet<> symbolHeaders;
 
 class DeclFilterCallbacks : public PPCallbacks {
+	Preprocessor& PP;
 	SourceManager& SM;
+	const LangOptions& LO;
+	LocationCache& locations;
+
+	// Definitions already recorded, keyed on the raw encoding of their
+	// definition location. A macro is typically expanded many times while
+	// only its definition ends up in the database.
+	llvm::DenseSet<unsigned> seenMacros;
+	unsigned macroEvents, suppressedMacroEvents;
+
+	// Identifiers in the bodies of the recorded macros which are no macros,
+	// to be resolved to decls at the end of the translation unit
+	std::vector<DeclWriter::MacroDep> macroRefs;
+
+	// Files being entered and when, to trace the time spent in each header
+	std::vector<std::pair<llvm::StringRef, uint64_t> > includeStack;
 
 	void addMacro(const Token &MacroNameTok,
 				  const MacroDirective *MD) {
-		const IdentifierInfo *II = MacroNameTok.getIdentifierInfo();
-		const MacroInfo *MI = MD->getMacroInfo();
+		addMacro(MacroNameTok.getIdentifierInfo(), MD->getMacroInfo());
+	}
+
+	void addMacro(const IdentifierInfo *II, const MacroInfo *MI) {
 		clang::SourceLocation start = MI->getDefinitionLoc(), end = MI->getDefinitionEndLoc();
 
+		macroEvents ++;
+		if (!seenMacros.insert(start.getRawEncoding()).second) {
+			suppressedMacroEvents ++;
+			return;
+		}
+
 		std::string name = II->getName();
-		llvm::StringRef file = SM.getFilename(start);
-		int startLine = SM.getExpansionLineNumber(start), startColumn = SM.getExpansionColumnNumber(start);
-		int endLine = SM.getExpansionLineNumber(end), endColumn = SM.getExpansionColumnNumber(end);
+		llvm::StringRef file = locations.getFilename(start);
+		FileLocation s = locations.getExpansionLoc(start), e = locations.getExpansionLoc(end);
+
+		SourceExtent extent = getMacroExtent(SM, LO, II, MI);
+
+		writer.addMacro(file, name, s.line, s.column, e.line, e.column, extent.start, extent.end);
+		addMacroDeps(file, name, II, MI);
+	}
 
-		executeSql("INSERT INTO macros VALUES ('%s', '%s', %d, %d, %d, %d)",
-				   file.str().c_str(), name.c_str(), startLine, startColumn, endLine, endColumn);
+	/// addMacroDeps - Record what the body of the macro @II refers to. The
+	/// macros it uses are recorded along with it, as the composer keeps
+	/// every recorded macro. Other identifiers are left to the consumer.
+	void addMacroDeps(llvm::StringRef file, llvm::StringRef name,
+					  const IdentifierInfo *II, const MacroInfo *MI) {
+		llvm::SmallPtrSet<IdentifierInfo *, 8> seen;
+		for (MacroInfo::tokens_iterator i = MI->tokens_begin(), e = MI->tokens_end(); i != e; i++) {
+			IdentifierInfo *ident = i->getIdentifierInfo();
+			// Note: keywords and parameters (__VA_ARGS__ included) are no
+			//       deps, and neither is the macro itself
+			if (!i->is(tok::identifier) || ident == II || MI->getArgumentNum(ident) >= 0 ||
+				!seen.insert(ident))
+				continue;
+
+			MacroDirective *MD = ident->hasMacroDefinition() ? PP.getMacroDirective(ident) : NULL;
+			if (MD && MD->getMacroInfo()->isBuiltinMacro())
+				continue;
+			if (MD) {
+				writer.addMacroDep(file, name, ident->getName(), MACRO_DEP_MACRO);
+				addMacro(ident, MD->getMacroInfo());
+			} else {
+				DeclWriter::MacroDep dep;
+				dep.header = file;
+				dep.name = name;
+				dep.ident = ident->getName();
+				dep.kind = MACRO_DEP_DECL;
+				macroRefs.push_back(dep);
+			}
+		}
 	}
 
 	void removeMacro(const Token &MacroNameTok) {
@@ -74,27 +131,42 @@ class DeclFilterCallbacks : public PPCallbacks {
 		clang::SourceLocation loc = MacroNameTok.getLocation();
 
 		std::string name = II->getName();
-		llvm::StringRef file = SM.getFilename(loc);
-		int line = SM.getExpansionLineNumber(loc);
+		llvm::StringRef file = locations.getFilename(loc);
+		int line = locations.getLineNumber(loc);
+		SourceExtent extent = getDirectiveExtent(SM, loc);
 
-		executeSql("INSERT INTO macros VALUES ('%s', '%s', %d, %d, %d, %d)",
-				   file.str().c_str(), name.c_str(), line, 1, line, 1);
+		writer.addMacro(file, name, line, 1, line, 1, extent.start, extent.end);
 	}
 
 public:
-	explicit DeclFilterCallbacks(SourceManager& sm)
-		: SM(sm) {
-		executeSql("CREATE TABLE IF NOT EXISTS deps (header TEXT NOT NULL, included TEXT NOT NULL, included_path TEXT NOT NULL, line INTEGER, force_keep INTEGER, PRIMARY KEY(header, included))");
-		executeSql("CREATE TABLE IF NOT EXISTS macros (header TEXT NOT NULL, name TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, PRIMARY KEY(header, name, start_line))");
+	explicit DeclFilterCallbacks(Preprocessor& pp, LocationCache& lc)
+		: PP(pp), SM(pp.getSourceManager()), LO(pp.getLangOpts()), locations(lc),
+		  macroEvents(0), suppressedMacroEvents(0) {}
+
+	const std::vector<DeclWriter::MacroDep> &getMacroRefs() const {
+		return macroRefs;
+	}
+
+	/// printStats - Report the macro events at the end of the translation
+	/// unit. Note: the preprocessor and its callbacks are leaked with
+	/// -disable-free, so do not count on the destructor.
+	void printStats() {
+		out << "macro events: " << macroEvents << ", recorded: " << seenMacros.size()
+			<< ", suppressed: " << suppressedMacroEvents << "\n";
+		trace.count("macros.events", macroEvents);
+		trace.count("macros.recorded", seenMacros.size());
+		trace.count("macros.suppressed", suppressedMacroEvents);
 	}
 
 	virtual void MacroUndefined(const Token &MacroNameTok, const MacroDirective *MD) {
+		trace.count("pp.MacroUndefined");
 		if (MD)
 			removeMacro(MacroNameTok);
 	}
 
 	virtual void Defined(const Token &MacroNameTok,
 						 const MacroDirective *MD) {
+		trace.count("pp.Defined");
 		if (MD)
 			addMacro(MacroNameTok, MD);
 	}
@@ -102,6 +174,7 @@ public:
 	virtual void Ifdef(SourceLocation Loc,
 					   const Token &MacroNameTok,
 					   const MacroDirective *MD) {
+		trace.count("pp.Ifdef");
 		if (MD)
 			addMacro(MacroNameTok, MD);
 	}
@@ -109,6 +182,7 @@ public:
 	virtual void Ifndef(SourceLocation Loc,
 						const Token &MacroNameTok,
 						const MacroDirective *MD) {
+		trace.count("pp.Ifndef");
 		if (MD)
 			addMacro(MacroNameTok, MD);
 	}
@@ -117,6 +191,7 @@ public:
 							  const MacroDirective *MD,
 							  SourceRange Range,
 							  const MacroArgs *Args) {
+		trace.count("pp.MacroExpands");
 		if (MD)
 			addMacro(MacroNameTok, MD);
 	}
@@ -130,30 +205,39 @@ public:
 									StringRef SearchPath,
 									StringRef RelativePath,
 									const Module *Imported) {
+		trace.count("pp.InclusionDirective");
 		if (!File)
 			return;
 
-		llvm::StringRef file = SM.getFilename(HashLoc);
-		int line = SM.getExpansionLineNumber(HashLoc);
+		llvm::StringRef file = locations.getFilename(HashLoc);
+		int line = locations.getLineNumber(HashLoc);
 
-		executeSql("INSERT INTO deps VALUES ('%s', '%s', '%s', %d, 0)", file.str().c_str(), FileName.str().c_str(), File->getName(), line);
+		writer.addDep(file, FileName, File->getName(), line);
 	}
 
 	virtual void FileChanged(SourceLocation Loc,
 							 FileChangeReason Reason,
 							 SrcMgr::CharacteristicKind FileType,
 							 FileID PrevFID) {
+		trace.count("pp.FileChanged");
 		if (currentFile.empty())
-			currentFile = SM.getFilename(Loc);
+			currentFile = locations.getFilename(Loc);
 		else
-			nextFile = SM.getFilename(Loc);
+			nextFile = locations.getFilename(Loc);
 
 		switch (Reason) {
+		case EnterFile:
+			if (trace.isEnabled() && SM.getFileEntryForID(SM.getFileID(Loc)))
+				includeStack.push_back(std::make_pair(locations.getFilename(Loc), trace.now()));
+			break;
 		case ExitFile:
 			if (SM.getFileEntryForID(PrevFID)) {
 				const char *included = SM.getFileEntryForID(PrevFID)->getName();
-				executeSql("UPDATE deps SET force_keep = 1 WHERE header = '%s' and included_path = '%s'",
-						   SM.getFilename(Loc).str().c_str(), included);
+				writer.setForceKeep(locations.getFilename(Loc), included);
+				if (!includeStack.empty()) {
+					trace.complete("include", includeStack.back().second, includeStack.back().first);
+					includeStack.pop_back();
+				}
 			}
 			break;
 		default:
@@ -163,91 +247,192 @@ public:
 };
 
 class DeclFilterConsumer : public ASTConsumer {
-	std::list<Decl *> _Ds;
-	std::map<Decl *, llvm::StringRef> _locations;
+	llvm::OwningPtr<LocationCache> _locationCache;
+	LocationCache &locations;
+	DeclFilterCallbacks *_callbacks;
+	// Whether to close the database at the end of the translation unit
+	bool _finish;
+	ASTContext *_context;
+	uint64_t _parseStart;
+	llvm::OwningPtr<DeclaratorPrinter> _printer;
+
+	// Top-level decls in the order they were parsed
+	std::vector<Decl *> _Ds;
+	// Files of decls expanded from macros, which have no location of their own
+	llvm::DenseMap<Decl *, llvm::StringRef> _locations;
+
+	// FIFO of decls reachable from the main file. Each decl is queued at most
+	// once, which is tracked by @_visited.
+	std::vector<Decl *> _worklist;
+	llvm::DenseSet<Decl *> _visited;
+
+	void enqueue(Decl *D) {
+		if (_visited.insert(D).second)
+			_worklist.push_back(D);
+	}
 
 	void markDeclReferenced(Decl *D) {
 		if (D->isReferenced())
 			return;
 		D->setReferenced();
-		_Ds.push_back(D);
+		enqueue(D);
 
 		// Note: include forward declarations as well
 		if (dyn_cast<RecordDecl>(D)) {
 			for (Decl::redecl_iterator i = D->redecls_begin(), e = D->redecls_end(); i != e; i ++) {
 				Decl *rd = *i;
 				if (rd != D)
-					_Ds.push_back(rd);
+					enqueue(rd);
 			}
 		}
 	}
 
-	void markTypeReferenced(const QualType &QT) {
-		const Type *T = QT.getTypePtr();
+	// Type nodes already walked by markTypeReferenced(). Types are uniqued by
+	// ASTContext, so the (sugared) type pointer identifies a spelling. Keying
+	// on canonical types would lose the typedefs we need to keep.
+	llvm::DenseSet<const Type *> _visitedTypes;
+	unsigned _typesVisited, _typesSkipped;
+	// Identifiers in macro bodies resolved to decls
+	unsigned _macroDeps;
 
-		if (dyn_cast<const BuiltinType>(T) || dyn_cast<const TypeOfExprType>(T))
-			return;
+	/// TypeMarker - Mark the declarations a type refers to as referenced.
+	class TypeMarker : public TypeVisitor<TypeMarker> {
+		DeclFilterConsumer &C;
 
-		// Note: this check must be placed before RecordType checks as
-		//       getAsXXXType() may strip off the typedef information
-		if (const TypedefType *TT = dyn_cast<const TypedefType>(T)) {
-			markDeclReferenced(TT->getDecl());
-			return;
+	public:
+		explicit TypeMarker(DeclFilterConsumer &c) : C(c) {}
+
+		void VisitBuiltinType(const BuiltinType *T) {}
+
+		void VisitTypeOfExprType(const TypeOfExprType *T) {
+			C.markExprReferenced(T->getUnderlyingExpr());
 		}
 
-		if (const RecordType *RT = T->getAsStructureType()) {
-			markDeclReferenced(RT->getDecl());
-			return;
+		// Note: typedefs must be handled before records as getAsXXXType()
+		//       may strip off the typedef information
+		void VisitTypedefType(const TypedefType *T) {
+			C.markDeclReferenced(T->getDecl());
 		}
 
-		if (const RecordType *RT = T->getAsUnionType()) {
-			markDeclReferenced(RT->getDecl());
-			return;
+		void VisitRecordType(const RecordType *T) {
+			C.markDeclReferenced(T->getDecl());
 		}
 
-		if (const EnumType *ET = dyn_cast<const EnumType>(T)) {
-			markDeclReferenced(ET->getDecl());
-			return;
+		void VisitEnumType(const EnumType *T) {
+			C.markDeclReferenced(T->getDecl());
 		}
 
-		if (const PointerType *PT = dyn_cast<const PointerType>(T)) {
-			markTypeReferenced(PT->getPointeeType());
-			return;
+		void VisitPointerType(const PointerType *T) {
+			C.markTypeReferenced(T->getPointeeType());
 		}
 
-		if (const ElaboratedType *ET = dyn_cast<const ElaboratedType>(T)) {
-			markTypeReferenced(ET->getNamedType());
-			return;
+		void VisitElaboratedType(const ElaboratedType *T) {
+			C.markTypeReferenced(T->getNamedType());
 		}
 
-		if (const ArrayType *AT = dyn_cast<const ArrayType>(T)) {
-			markTypeReferenced(AT->getElementType());
-			return;
+		void VisitArrayType(const ArrayType *T) {
+			C.markTypeReferenced(T->getElementType());
 		}
 
-		if (const TypeOfType *TOT = dyn_cast<const TypeOfType>(T)) {
-			markTypeReferenced(TOT->getUnderlyingType());
-			return;
+		void VisitVariableArrayType(const VariableArrayType *T) {
+			C.markTypeReferenced(T->getElementType());
+			C.markExprReferenced(T->getSizeExpr());
 		}
 
-		if (const FunctionProtoType *FPT = dyn_cast<const FunctionProtoType>(T)) {
-			for (unsigned int i = 0; i < FPT->getNumArgs(); i ++)
-				markTypeReferenced(FPT->getArgType(i));
-			markTypeReferenced(FPT->getResultType());
-			return;
+		void VisitVectorType(const VectorType *T) {
+			C.markTypeReferenced(T->getElementType());
 		}
 
-		if (const PointerType *PT = dyn_cast<const PointerType>(T)) {
-			markTypeReferenced(PT->getPointeeType());
-			return;
+		void VisitComplexType(const ComplexType *T) {
+			C.markTypeReferenced(T->getElementType());
 		}
 
-		if (const ParenType *PT = dyn_cast<const ParenType>(T)) {
-			markTypeReferenced(PT->getInnerType());
-			return;
+		void VisitAtomicType(const AtomicType *T) {
+			C.markTypeReferenced(T->getValueType());
+		}
+
+		void VisitAttributedType(const AttributedType *T) {
+			C.markTypeReferenced(T->getModifiedType());
 		}
 
-		out << "not handled class(" << T->getTypeClass() << ") " << QT.getAsString() << "\n";
+		void VisitTypeOfType(const TypeOfType *T) {
+			C.markTypeReferenced(T->getUnderlyingType());
+		}
+
+		void VisitFunctionNoProtoType(const FunctionNoProtoType *T) {
+			C.markTypeReferenced(T->getResultType());
+		}
+
+		void VisitFunctionProtoType(const FunctionProtoType *T) {
+			for (unsigned int i = 0; i < T->getNumArgs(); i ++)
+				C.markTypeReferenced(T->getArgType(i));
+			C.markTypeReferenced(T->getResultType());
+		}
+
+		void VisitParenType(const ParenType *T) {
+			C.markTypeReferenced(T->getInnerType());
+		}
+
+		void VisitType(const Type *T) {
+			if (const RecordType *RT = T->getAsStructureType()) {
+				C.markDeclReferenced(RT->getDecl());
+				return;
+			}
+
+			if (const RecordType *RT = T->getAsUnionType()) {
+				C.markDeclReferenced(RT->getDecl());
+				return;
+			}
+
+			out << "not handled class(" << T->getTypeClass() << ") " << QualType(T, 0).getAsString() << "\n";
+		}
+	};
+
+	/// ExprMarker - Mark the declarations expressions and type locations
+	/// refer to as referenced: enum constants in array bounds, initializers,
+	/// bit-field widths, typeof() and the bodies of inline functions.
+	class ExprMarker : public RecursiveASTVisitor<ExprMarker> {
+		DeclFilterConsumer &C;
+
+	public:
+		explicit ExprMarker(DeclFilterConsumer &c) : C(c) {}
+
+		bool VisitDeclRefExpr(DeclRefExpr *E) {
+			C.markValueReferenced(E->getDecl());
+			return true;
+		}
+
+		// Note: covers the types in casts, sizeof(), compound literals and
+		//       local declarations, which appear nowhere else
+		bool VisitTypeLoc(TypeLoc TL) {
+			C.markTypeReferenced(TL.getType());
+			return true;
+		}
+	};
+
+	void markExprReferenced(Expr *E) {
+		if (E)
+			ExprMarker(*this).TraverseStmt(E);
+	}
+
+	void markValueReferenced(ValueDecl *D) {
+		if (EnumConstantDecl *ECD = dyn_cast<EnumConstantDecl>(D)) {
+			// Note: constants come with their enum
+			markDeclReferenced(cast<EnumDecl>(ECD->getDeclContext()));
+		} else if (D->getDeclContext()->isFileContext()) {
+			markDeclReferenced(D);
+		}
+	}
+
+	void markTypeReferenced(const QualType &QT) {
+		const Type *T = QT.getTypePtr();
+
+		if (!_visitedTypes.insert(T).second) {
+			_typesSkipped ++;
+			return;
+		}
+		_typesVisited ++;
+		TypeMarker(*this).Visit(T);
 	}
 
 	void markDependencies(Decl *D) {
@@ -265,134 +450,178 @@ class DeclFilterConsumer : public ASTConsumer {
 		} else if (TypedefDecl *TD = dyn_cast<TypedefDecl>(D)) {
 			markTypeReferenced(TD->getUnderlyingType());
 		} else if (dyn_cast<EnumDecl>(D)) {
-			/* Enums consist of constants and have no more declarations in them */
+			/* Enums consist of constants, whose values are walked below */
 		} else if (VarDecl *VD = dyn_cast<VarDecl>(D)) {
 			markTypeReferenced(VD->getType());
 		} else if (FieldDecl *FD = dyn_cast<FieldDecl>(D)) {
 			markTypeReferenced(FD->getType());
 		} else if (IndirectFieldDecl *IFD = dyn_cast<IndirectFieldDecl>(D)) {
 			markTypeReferenced(IFD->getType());
-		} else if (dyn_cast<EmptyDecl>(D)) {
+		} else if (EnumConstantDecl *ECD = dyn_cast<EnumConstantDecl>(D)) {
+			markDeclReferenced(cast<EnumDecl>(ECD->getDeclContext()));
+		} else if (isa<EmptyDecl>(D) || isa<StaticAssertDecl>(D) || isa<FileScopeAsmDecl>(D)) {
+			/* Nothing but expressions, if at all */
 		} else {
 			out << "Unhandled decl: " << D->getDeclKindName() << "\n";
+			trace.count("decls.unhandled");
 		}
+
+		// Types only tell part of the story: array bounds (which are gone
+		// from constant array types), typeof() in declarators, initializers,
+		// enumerator values, bit-field widths and function bodies refer to
+		// declarations as well. Note: only decls reachable from the main
+		// file get here, so unused inline functions are not walked.
+		ExprMarker(*this).TraverseDecl(D);
 	}
 
-	llvm::StringRef tryFindFile(Decl *d) {
-		return _locations[d];
-	}
-
-	std::string printNameWithType(std::string name, std::string type, bool addFormal = false) {
-		/* Handle function pointers */
-		std::size_t pos = type.find("(*)");
-		if (pos != std::string::npos) {
-			std::string acc = type.insert(pos + 2, name);
-			if (addFormal) {
-				char arg[3] = " a";
-				pos = acc.find("(void)");
-				if (pos == std::string::npos) {
-					while ((pos = acc.find(",", pos)) != std::string::npos) {
-						acc = acc.insert(pos, arg);
-						arg[1] ++;
-						pos += 3;
-					}
-					pos = acc.find("...");
-					if (pos == std::string::npos) {
-						pos = 0;
-						while ((pos = acc.find("(*)", pos)) != std::string::npos)
-							pos ++;
-						pos = acc.rfind(")");
-						acc = acc.insert(pos, arg);
-					}
-				}
-			}
-			return acc;
-		}
+	/// markMacroDeps - Resolve the identifiers in the bodies of the recorded
+	/// macros to decls and mark them referenced, so that the macros compile
+	/// wherever they are expanded. Unresolved ones are locals or members,
+	/// e.g. of the struct a macro like container_of() is given.
+	void markMacroDeps(const std::vector<DeclWriter::MacroDep> &deps) {
+		TranslationUnitDecl *TU = _context->getTranslationUnitDecl();
+		for (unsigned i = 0; i < deps.size(); i++) {
+			const DeclWriter::MacroDep &dep = deps[i];
+			if (dep.kind != MACRO_DEP_DECL)
+				continue;
 
-		if (type.find("typeof") == std::string::npos) {
-			pos = type.find("(");
-			if (pos != std::string::npos) {
-				std::string ingre = "(" + name + ")";
-				std::string acc = type.insert(pos, ingre);
-				return acc;
+			// Note: enum constants are found here as well, enums being
+			//       transparent contexts in C
+			DeclContext::lookup_result R = TU->lookup(DeclarationName(&_context->Idents.get(dep.ident)));
+			if (R.begin() == R.end())
+				continue;
+			for (DeclContext::lookup_iterator j = R.begin(), e = R.end(); j != e; j++) {
+				if (ValueDecl *VD = dyn_cast<ValueDecl>(*j))
+					markValueReferenced(VD);
+				else
+					markDeclReferenced(*j);
 			}
+			writer.addMacroDep(dep.header, dep.name, dep.ident, MACRO_DEP_DECL);
+			_macroDeps ++;
 		}
+	}
 
-		/* Handle arrays */
-		pos = type.find("[");
-		if (pos != std::string::npos)
-			return type.insert(pos, name);
+	llvm::StringRef tryFindFile(Decl *d) {
+		return _locations.lookup(d);
+	}
 
-		return type + " " + name;
+	/// getFile - Get the file @D is declared in. @fromMacro is set if @D is
+	/// expanded from a macro and the file is guessed by tryFindFile().
+	llvm::StringRef getFile(Decl *D, int &fromMacro) {
+		llvm::StringRef file = locations.getFilename(D->getLocStart());
+
+		fromMacro = 0;
+		if (file.empty()) {
+			// Note: declarations expanded from macros are located in a
+			//       'scratch space', which leads us to an empty @file. Here
+			//       we try to find where this declaration resides by
+			//       looking at the other declarations following.
+			fromMacro = 1;
+			file = tryFindFile(D);
+		}
+		return file;
 	}
 
+	// Note: the comment attached before a prototype goes along with it, the
+	//       composer puts it in front of the stub of an undefined symbol
 	void dumpFunction(const FunctionDecl *d, llvm::StringRef file) {
-		std::string name = d->getNameAsString();
-		std::string ret = d->getResultType().getAsString();
-		std::vector<std::string> args;
+		llvm::StringRef comment;
+		SourceExtent extent = getLeadingComment(d->getASTContext().getSourceManager(), d, comment);
+		writer.addPrototype(d->getNameAsString(), _printer->printPrototype(d), file, 1,
+							extent.start, extent.end, comment);
+	}
 
-		for (FunctionDecl::param_const_iterator i = d->param_begin(), e = d->param_end();
-			 i != e;
-			 i++) {
-			QualType type = (*i)->getOriginalType();
-			args.push_back(type.getAsString());
-		}
+	void dumpVar(const VarDecl *d, llvm::StringRef file) {
+		llvm::StringRef comment;
+		SourceExtent extent = getLeadingComment(d->getASTContext().getSourceManager(), d, comment);
+		writer.addPrototype(d->getNameAsString(), _printer->printExtern(d), file, 0,
+							extent.start, extent.end, comment);
+	}
+
+	/// recordDecl - Bookkeeping of a top-level decl. @fallbackFile is used
+	/// for decls expanded from macros which have no file of their own.
+	void recordDecl(Decl *D, llvm::StringRef fallbackFile) {
+		// XXX: Reuse the TopLevelDeclInObjCContainer flag to mark this decl as toplevel
+		D->setTopLevelDeclInObjCContainer();
 
-		std::string def;
-		llvm::raw_string_ostream os(def);
+		std::string name = "";
+		if (const NamedDecl *ND = dyn_cast<const NamedDecl>(D))
+			name = ND->getNameAsString();
 
-		os << ret << " " << name << "(";
-		char pn[2] = "a";
-		for (int i = 0, size = args.size(); i < size; i++) {
-			pn[0] = 'a' + i;
-			os << printNameWithType(pn, args[i]);
-			if (i < size - 1)
-				os << ", ";
+		clang::SourceLocation start = D->getLocStart(), end = D->getLocEnd();
+		llvm::StringRef file = locations.getFilename(start);
+		FileLocation s = locations.getExpansionLoc(start), e = locations.getExpansionLoc(end);
+
+		if (file.empty())
+			_locations[D] = fallbackFile;
+
+		// Note: all_decls only serves as the fallback lookup of the composer,
+		//       which finds the decls of the headers of the symbol database
+		//       there
+		if (symbolHeaders.count(file)) {
+			trace.count("all_decls.symbols");
+			return;
 		}
-		if (d->isVariadic())
-			os << ", ...";
-		os << ")";
 
-		executeSql("INSERT INTO prototypes VALUES ('%s', '%s', '%s', %d)", name.c_str(), os.str().c_str(), file.str().c_str(), 1);
+		if (name != "")
+			writer.addAllDecl(file, name, s.line, s.column, e.line, e.column);
+		if (EnumDecl *ED = dyn_cast<EnumDecl>(D)) {
+			// Note: the constants come with the extent of their enum
+			for (EnumDecl::enumerator_iterator i = ED->enumerator_begin(), ie = ED->enumerator_end();
+				 i != ie;
+				 i ++)
+				writer.addAllDecl(file, i->getName(), s.line, s.column, e.line, e.column);
+		}
 	}
 
-	void dumpVar(const VarDecl *d, llvm::StringRef file) {
-		std::string name = d->getNameAsString();
-		std::string type = d->getType().getAsString();
-		std::string def;
-		llvm::raw_string_ostream os(def);
-
-		os << "extern " << printNameWithType(name, type);
+	/// loadPrecompiledDecls - Decls deserialized from a PCH never go through
+	/// HandleTopLevelDecl(). Record them in the order they were parsed when
+	/// building the PCH, ahead of the decls of the main file, so that the
+	/// output matches a run parsing the prefix headers.
+	void loadPrecompiledDecls() {
+		if (!_context || !_context->getExternalSource())
+			return;
 
-		executeSql("INSERT INTO prototypes VALUES ('%s', '%s', '%s', %d)", name.c_str(), os.str().c_str(), file.str().c_str(), 0);
+		std::vector<Decl *> Ds;
+		TranslationUnitDecl *TU = _context->getTranslationUnitDecl();
+		for (DeclContext::decl_iterator i = TU->decls_begin(), e = TU->decls_end(); i != e; i++) {
+			Decl *D = *i;
+			if (!D->isFromASTFile() || D->isImplicit())
+				continue;
+			// Note: there are no FileChanged() events to track the current
+			//       file inside a PCH, use where the macro was expanded
+			recordDecl(D, locations.getExpansionLoc(D->getLocStart()).name);
+			Ds.push_back(D);
+		}
+		_Ds.insert(_Ds.begin(), Ds.begin(), Ds.end());
+		out << "precompiled decls: " << Ds.size() << "\n";
+		trace.count("decls.precompiled", Ds.size());
 	}
 
 public:
-	explicit DeclFilterConsumer() {
-		executeSql("CREATE TABLE IF NOT EXISTS prototypes (name TEXT NOT NULL, prototype TEXT, header TEXT, is_function INTEGER, PRIMARY KEY(name))");
-		executeSql("CREATE TABLE IF NOT EXISTS decls (header TEXT NOT NULL, name TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, kind INTEGER, from_macro INTEGER, has_body INTEGER, PRIMARY KEY(header, name, start_line, kind))");
-		executeSql("CREATE TABLE IF NOT EXISTS all_decls (header TEXT NOT NULL, ident TEXT NOT NULL, start_line INTEGER, start_column INTEGER, end_line INTEGER, end_column INTEGER, PRIMARY KEY(header, ident, start_line))");
+	/// DeclFilterConsumer - Take over @lc, which @callbacks record locations
+	/// in as well.
+	DeclFilterConsumer(LocationCache *lc, DeclFilterCallbacks *callbacks, bool finish)
+		: _locationCache(lc), locations(*lc), _callbacks(callbacks), _finish(finish),
+		  _context(NULL), _parseStart(0), _typesVisited(0), _typesSkipped(0), _macroDeps(0) {}
+
+	virtual void Initialize(ASTContext &Context) {
+		_context = &Context;
+		_printer.reset(new DeclaratorPrinter(Context.getPrintingPolicy()));
+		if (trace.isEnabled())
+			_parseStart = trace.now();
 	}
 
 	virtual bool HandleTopLevelDecl(DeclGroupRef DG) {
 		for (DeclGroupRef::iterator i = DG.begin(), e = DG.end(); i != e; i++) {
 			Decl *D = *i;
 
-			// XXX: Reuse the TopLevelDeclInObjCContainer flag to mark this decl as toplevel
-			D->setTopLevelDeclInObjCContainer();
-
-			std::string name = "";
-			if (const NamedDecl *ND = dyn_cast<const NamedDecl>(D))
-				name = ND->getNameAsString();
-
-			clang::SourceManager &SM = D->getASTContext().getSourceManager();
-			clang::SourceLocation start = D->getLocStart(), end = D->getLocEnd();
-			llvm::StringRef file = SM.getFilename(start);
-			int startLine = SM.getExpansionLineNumber(start), startColumn = SM.getExpansionColumnNumber(start);
-			int endLine = SM.getExpansionLineNumber(end), endColumn = SM.getExpansionColumnNumber(end);
+			// Note: decls deserialized from a PCH are passed here as well
+			//       if the PCH reader deems them interesting
+			if (D->isFromASTFile())
+				continue;
 
-			if (file.empty())
-				_locations[D] = currentFile;
+			recordDecl(D, currentFile);
 
 			// XXX Currently the last declaration is seen after file changes. So
 			//   we need to record the next file in FileChanged and switch to it
@@ -402,53 +631,53 @@ public:
 				nextFile = "";
 			}
 
-			if (name != "")
-				executeSql("INSERT INTO all_decls VALUES ('%s', '%s', %d, %d, %d, %d)",
-						   file.str().c_str(), name.c_str(),
-						   startLine, startColumn, endLine, endColumn);
-			if (EnumDecl *ED = dyn_cast<EnumDecl>(D)) {
-				for (EnumDecl::enumerator_iterator i = ED->enumerator_begin(), e = ED->enumerator_end();
-					 i != e;
-					 i ++)
-					executeSql("INSERT INTO all_decls VALUES ('%s', '%s', %d, %d, %d, %d)",
-							   file.str().c_str(), i->getNameAsString().c_str(),
-							   startLine, startColumn, endLine, endColumn);
-			}
-
 			_Ds.push_back(D);
 		}
 		return true;
 	}
 
-	virtual void PrintStats() {
-		// 1. Remove unreferenced decls
-		//    Only decls used in the main file are marked referenced currently.
-		std::list<Decl *>::iterator i = _Ds.begin();
-		while (i != _Ds.end()) {
-			Decl *D = *i;
+	virtual void HandleTranslationUnit(ASTContext &Context) {
+		if (trace.isEnabled()) {
+			SourceManager &SM = Context.getSourceManager();
+			trace.complete("parse", _parseStart, locations.getName(SM.getMainFileID()));
+		}
+		traverse();
+		_callbacks->printStats();
+
+		// Note: when added to the compiler's actions (-add-plugin), the
+		//       plugin action is gone by now and no other hook is left to
+		//       finish the database
+		if (_finish) {
+			writer.close();
+			trace.close();
+			out << "========== done ==========\n";
+		}
+	}
 
-			std::string name = "";
-			if (const NamedDecl *ND = dyn_cast<const NamedDecl>(D))
-				name = ND->getNameAsString();
+	void traverse() {
+		TraceScope scope(trace, "traverse");
 
-			// Note: Cannot ignore declarations in the main source file
-			clang::SourceManager &SM = D->getASTContext().getSourceManager();
-			clang::SourceLocation start = D->getLocStart();
-			llvm::StringRef file = SM.getFilename(start);
-			if (file.empty())
-				file = tryFindFile(D);
+		loadPrecompiledDecls();
 
-			if (!D->isReferenced() && !file.endswith(".c"))
-				_Ds.erase(i++);
-			else
-				i++;
+		// 1. Seed the worklist with referenced decls
+		//    Only decls used in the main file are marked referenced currently.
+		//    Note: Cannot ignore declarations in the main source file
+		int from_macro;
+		for (std::vector<Decl *>::iterator i = _Ds.begin(), e = _Ds.end(); i != e; i++) {
+			Decl *D = *i;
+			if (D->isReferenced() || getFile(D, from_macro).endswith(".c"))
+				enqueue(D);
 		}
 
-		// 2. Iterate the decl list until it is empty
-		i = _Ds.begin();
-		while (!_Ds.empty()) {
-			Decl *D = *i;
-			int from_macro = 0;
+		// 2. Add what the recorded macros refer to. The composer keeps all
+		//    of them, whether expanded in the main file or not.
+		markMacroDeps(prefixMacroDeps);
+		markMacroDeps(_callbacks->getMacroRefs());
+
+		// 3. Walk everything reachable from the seeds. markDependencies()
+		//    appends to @_worklist, so do not hold iterators across it.
+		for (std::size_t i = 0; i < _worklist.size(); i++) {
+			Decl *D = _worklist[i];
 
 			std::string name = "";
 			if (const NamedDecl *ND = dyn_cast<const NamedDecl>(D))
@@ -462,76 +691,124 @@ public:
 				}
 			}
 
-			clang::SourceManager &SM = D->getASTContext().getSourceManager();
-			clang::SourceLocation loc = D->getLocStart();
-			llvm::StringRef file = SM.getFilename(loc);
-
-			if (file.empty()) {
-				// Note: declarations expanded from macros are located in a
-				//       'scratch space', which leads us to an empty @file. Here
-				//       we try to find where this declaration resides by
-				//       looking at the other declarations following.
-				from_macro = 1;
-				file = tryFindFile(D);
-			}
-			if (file.endswith(".c")) {
-				markDependencies(D);
-				_Ds.erase(i++);
-				continue;
-			}
-
+			llvm::StringRef file = getFile(D, from_macro);
 			markDependencies(D);
+			if (file.endswith(".c"))
+				continue;
 
-			clang::SourceLocation start = D->getLocStart(), end = D->getLocEnd();
-			int startLine = SM.getExpansionLineNumber(start), startColumn = SM.getExpansionColumnNumber(start);
-			int endLine = SM.getExpansionLineNumber(end), endColumn = SM.getExpansionColumnNumber(end);
+			FileLocation s = locations.getExpansionLoc(D->getLocStart());
+			FileLocation e = locations.getExpansionLoc(D->getLocEnd());
 
 			// Note: Only mark top level decls as nested decls will be automatically included
 			if (D->isTopLevelDeclInObjCContainer()) {
-				executeSql("INSERT INTO decls VALUES ('%s', '%s', %d, %d, %d, %d, %d, %d, %d)",
-						   file.str().c_str(), name.c_str(), startLine, startColumn, endLine, endColumn,
-						   D->getKind(), from_macro, D->hasBody() ? 1 : 0);
+				SourceExtent extent = getDeclExtent(D->getASTContext().getSourceManager(),
+													D->getASTContext().getLangOpts(), D);
+				writer.addDecl(file, name, s.line, s.column, e.line, e.column,
+							   D->getKind(), from_macro, D->hasBody() ? 1 : 0,
+							   extent.start, extent.end);
 				if (FunctionDecl *FD = dyn_cast<FunctionDecl>(D))
 					dumpFunction(FD, file);
 				else if (VarDecl *VD = dyn_cast<VarDecl>(D))
 					dumpVar(VD, file);
 			}
-			_Ds.erase(i++);
 		}
+
+		out << "decls: " << _Ds.size() << ", reachable: " << _worklist.size() << "\n";
+		out << "type nodes visited: " << _typesVisited << ", skipped: " << _typesSkipped << "\n";
+		out << "macro deps on decls: " << _macroDeps << "\n";
+		trace.count("decls", _Ds.size());
+		trace.count("decls.reachable", _worklist.size());
+		trace.count("types.visited", _typesVisited);
+		trace.count("types.skipped", _typesSkipped);
+		trace.count("macros.deps", _macroDeps);
+		_worklist.clear();
+		_visited.clear();
+		_visitedTypes.clear();
 	}
 };
 
 class DeclFilterAction : public PluginASTAction {
+	// Whether the plugin is the main action (-plugin) rather than added to
+	// the actions of the compiler (-add-plugin)
+	bool isMainAction;
+
 protected:
+	/// CreateASTConsumer - Called per input file in both modes, while
+	/// BeginSourceFileAction() is only called for the main action.
 	ASTConsumer *CreateASTConsumer(CompilerInstance &CI, llvm::StringRef) {
-		return new DeclFilterConsumer();
+		Preprocessor &PP = CI.getPreprocessor();
+		// Note: FileIDs are reset for every input file
+		LocationCache *locations = new LocationCache(CI.getSourceManager());
+		DeclFilterCallbacks *callbacks = new DeclFilterCallbacks(PP, *locations);
+		PP.addPPCallbacks(callbacks);
+		currentFile = nextFile = StringRef();
+		// Note: a main action may process several input files, which all
+		//       go to the database closed by the destructor
+		return new DeclFilterConsumer(locations, callbacks, !isMainAction);
 	}
 
 	bool ParseArgs(const CompilerInstance &CI,
 			       const std::vector<std::string>& args) {
-		conn = NULL;
-
-		if (args.size() > 0) {
-			std::string database = args[0];
-			sqlite3_open(database.c_str(), &conn);
-			sqlite3_exec(conn, "begin;", 0, 0, 0);
+		if (args.empty())
+			return true;
+
+		// Usage: -plugin-arg-decl-filter <database>
+		//        [-plugin-arg-decl-filter in-memory]
+		//        [-plugin-arg-decl-filter chunk=<rows>]
+		//        [-plugin-arg-decl-filter format=sqlite|index]
+		//        [-plugin-arg-decl-filter prefix=<prefix database>]
+		//        [-plugin-arg-decl-filter symbols=<symbol database>]
+		//        [-plugin-arg-decl-filter trace=<trace json>]
+		std::string database = args[0], prefix, symbols;
+		bool inMemory = false, binaryIndex = false;
+		unsigned chunk = DeclWriter::DEFAULT_CHUNK_SIZE;
+		for (unsigned i = 1; i < args.size(); i++) {
+			llvm::StringRef arg(args[i]);
+			if (arg == "in-memory") {
+				inMemory = true;
+			} else if (arg == "format=sqlite") {
+				binaryIndex = false;
+			} else if (arg == "format=index") {
+				binaryIndex = true;
+			} else if (arg.startswith("trace=")) {
+				trace.open(arg.substr(6), "decl-filter");
+			} else if (arg.startswith("prefix=")) {
+				prefix = arg.substr(7);
+			} else if (arg.startswith("symbols=")) {
+				symbols = arg.substr(8);
+			} else if (arg.startswith("chunk=")) {
+				if (arg.substr(6).getAsInteger(10, chunk)) {
+					llvm::errs() << "decl-filter: invalid chunk size '" << arg.substr(6) << "'\n";
+					return false;
+				}
+			} else {
+				llvm::errs() << "decl-filter: unknown argument '" << arg << "'\n";
+				return false;
+			}
 		}
 
+		if (!symbols.empty() && !DeclWriter::loadSymbolHeaders(symbols, symbolHeaders))
+			return false;
+		if (binaryIndex ? !writer.openIndex(database) : !writer.open(database, inMemory, chunk))
+			return false;
+		if (!prefix.empty())
+			return writer.importPrefix(prefix, &prefixMacroDeps);
 		return true;
 	}
 
 	bool BeginSourceFileAction(CompilerInstance& CI, llvm::StringRef) {
-		Preprocessor &PP = CI.getPreprocessor();
-		PP.addPPCallbacks(new DeclFilterCallbacks(CI.getSourceManager()));
+		isMainAction = true;
 		return true;
 	}
 
 public:
+	DeclFilterAction() : isMainAction(false) {}
+
 	virtual ~DeclFilterAction() {
-		if (conn) {
-			sqlite3_exec(conn, "commit;", 0, 0, 0);
-			sqlite3_close(conn);
-		}
+		if (!isMainAction)
+			return;
+		writer.close();
+		trace.close();
 		out << "========== done ==========\n";
 	}
 };
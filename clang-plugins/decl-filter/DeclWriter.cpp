@@ -0,0 +1,444 @@
+//===- DeclWriter.cpp -----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Batched SQLite writer used by DeclFilter.
+//
+//===----------------------------------------------------------------------===//
+
+#include "DeclWriter.h"
+#include "DeclSchema.h"
+#include "PluginTrace.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <unistd.h>
+
+// Indexed by DeclWriter::Statement
+static const char *statements[DeclWriter::NR_STATEMENTS] = {
+	"INSERT OR IGNORE INTO macros VALUES (?, ?, ?, ?, ?, ?, ?, ?)",
+	"INSERT OR IGNORE INTO deps VALUES (?, ?, ?, ?, 0)",
+	"UPDATE deps SET force_keep = 1 WHERE header = ? AND included_path = ?",
+	"INSERT OR IGNORE INTO decls VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+	"INSERT OR IGNORE INTO all_decls VALUES (?, ?, ?, ?, ?, ?)",
+	"INSERT OR IGNORE INTO prototypes VALUES (?, ?, ?, ?, ?, ?, ?)",
+	"INSERT OR IGNORE INTO macro_deps VALUES (?, ?, ?, ?)",
+};
+
+// Counters of rows written and rows dropped as duplicates, indexed by
+// DeclWriter::Statement
+static const char *insertedCounters[DeclWriter::NR_STATEMENTS] = {
+	"rows.macros",
+	"rows.deps",
+	"rows.deps.force_keep",
+	"rows.decls",
+	"rows.all_decls",
+	"rows.prototypes",
+	"rows.macro_deps",
+};
+
+static const char *ignoredCounters[DeclWriter::NR_STATEMENTS] = {
+	"rows.macros.ignored",
+	"rows.deps.ignored",
+	"rows.deps.force_keep.ignored",
+	"rows.decls.ignored",
+	"rows.all_decls.ignored",
+	"rows.prototypes.ignored",
+	"rows.macro_deps.ignored",
+};
+
+DeclWriter::DeclWriter()
+	: db(NULL), inMemory(false), chunkSize(DEFAULT_CHUNK_SIZE), pending(0) {
+	for (int i = 0; i < NR_STATEMENTS; i++)
+		stmts[i] = NULL;
+}
+
+DeclWriter::~DeclWriter() {
+	close();
+}
+
+bool DeclWriter::open(const std::string &path, bool memory, unsigned chunk) {
+	close();
+
+	target = path;
+	temp = path + ".tmp";
+	inMemory = memory;
+	chunkSize = chunk;
+	pending = 0;
+
+	// Note: whatever @path holds is replaced, so that no stale rows or
+	//       tables of an older schema survive, and readers never see a
+	//       partially written database
+	unlink(temp.c_str());
+	if (sqlite3_open(inMemory ? ":memory:" : temp.c_str(), &db) != SQLITE_OK) {
+		llvm::errs() << "cannot open " << temp << ": " << sqlite3_errmsg(db) << "\n";
+		sqlite3_close(db);
+		db = NULL;
+		return false;
+	}
+
+	if (!inMemory) {
+		sqlite3_exec(db, "PRAGMA synchronous = OFF;", 0, 0, 0);
+		sqlite3_exec(db, "PRAGMA journal_mode = MEMORY;", 0, 0, 0);
+	}
+
+	createDeclTables(db);
+	if (!prepareStatements()) {
+		discard();
+		return false;
+	}
+	sqlite3_exec(db, "BEGIN;", 0, 0, 0);
+	return true;
+}
+
+bool DeclWriter::openIndex(const std::string &path) {
+	close();
+
+	target = path;
+	index.reset(new DeclIndexBuilder());
+	return true;
+}
+
+void DeclWriter::close() {
+	if (index) {
+		TraceScope scope(PluginTrace::get(), "write index");
+		if (!index->write(target))
+			llvm::errs() << "cannot write index " << target << "\n";
+		index.reset();
+	}
+
+	if (!db)
+		return;
+
+	finalizeStatements();
+	{
+		TraceScope scope(PluginTrace::get(), "commit");
+		sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+	}
+	PluginTrace::get().writeStats(db);
+
+	bool ok = true;
+	if (inMemory) {
+		TraceScope scope(PluginTrace::get(), "copy");
+		sqlite3 *file;
+		if (sqlite3_open(temp.c_str(), &file) == SQLITE_OK) {
+			ok = copyDatabase(db, file);
+		} else {
+			llvm::errs() << "cannot open " << temp << ": " << sqlite3_errmsg(file) << "\n";
+			ok = false;
+		}
+		sqlite3_close(file);
+	}
+
+	sqlite3_close(db);
+	db = NULL;
+
+	if (!ok || rename(temp.c_str(), target.c_str()) != 0) {
+		llvm::errs() << "cannot write " << target << "\n";
+		unlink(temp.c_str());
+	}
+}
+
+void DeclWriter::discard() {
+	finalizeStatements();
+	sqlite3_close(db);
+	db = NULL;
+	unlink(temp.c_str());
+}
+
+bool DeclWriter::importPrefix(const std::string &path, std::vector<MacroDep> *macroDeps) {
+	sqlite3 *prefix;
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_open_v2(path.c_str(), &prefix, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+		llvm::errs() << "cannot open " << path << ": " << sqlite3_errmsg(prefix) << "\n";
+		sqlite3_close(prefix);
+		return false;
+	}
+
+	if (sqlite3_prepare_v2(prefix, "SELECT * FROM macros", -1, &stmt, NULL) == SQLITE_OK) {
+		while (sqlite3_step(stmt) == SQLITE_ROW)
+			addMacro(text(stmt, 0), text(stmt, 1),
+					 sqlite3_column_int(stmt, 2), sqlite3_column_int(stmt, 3),
+					 sqlite3_column_int(stmt, 4), sqlite3_column_int(stmt, 5),
+					 sqlite3_column_int(stmt, 6), sqlite3_column_int(stmt, 7));
+	}
+	sqlite3_finalize(stmt);
+
+	// Note: prefix databases built before macro_deps was added lack it
+	if (sqlite3_prepare_v2(prefix, "SELECT * FROM macro_deps", -1, &stmt, NULL) == SQLITE_OK) {
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			MacroDep dep;
+			dep.header = text(stmt, 0);
+			dep.name = text(stmt, 1);
+			dep.ident = text(stmt, 2);
+			dep.kind = sqlite3_column_int(stmt, 3);
+			addMacroDep(dep.header, dep.name, dep.ident, dep.kind);
+			if (macroDeps)
+				macroDeps->push_back(dep);
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	// Note: the sources include the headers the prefix header does
+	//       themselves. The prefix header is the main file of the prefix
+	//       run, the only header no other one includes.
+	if (sqlite3_prepare_v2(prefix, "SELECT * FROM deps WHERE header IN (SELECT included_path FROM deps)",
+						   -1, &stmt, NULL) == SQLITE_OK) {
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			llvm::StringRef header = text(stmt, 0), includedPath = text(stmt, 2);
+			addDep(header, text(stmt, 1), includedPath, sqlite3_column_int(stmt, 3));
+			if (sqlite3_column_int(stmt, 4))
+				setForceKeep(header, includedPath);
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	sqlite3_close(prefix);
+	return true;
+}
+
+bool DeclWriter::loadSymbolHeaders(const std::string &path, llvm::StringSet<> &headers) {
+	sqlite3 *symbols;
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_open_v2(path.c_str(), &symbols, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+		llvm::errs() << "cannot open " << path << ": " << sqlite3_errmsg(symbols) << "\n";
+		sqlite3_close(symbols);
+		return false;
+	}
+
+	int version = -1;
+	if (sqlite3_prepare_v2(symbols, "PRAGMA user_version", -1, &stmt, NULL) == SQLITE_OK &&
+		sqlite3_step(stmt) == SQLITE_ROW)
+		version = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+	if (version != DECL_SCHEMA_VERSION) {
+		llvm::errs() << path << ": schema version " << version << ", expected " << DECL_SCHEMA_VERSION << "\n";
+		sqlite3_close(symbols);
+		return false;
+	}
+
+	// Note: a scan of the primary key, which starts with the header
+	bool ok = sqlite3_prepare_v2(symbols, "SELECT DISTINCT header FROM all_decls", -1, &stmt, NULL) == SQLITE_OK;
+	if (ok) {
+		while (sqlite3_step(stmt) == SQLITE_ROW)
+			headers.insert(text(stmt, 0));
+	} else {
+		llvm::errs() << path << ": " << sqlite3_errmsg(symbols) << "\n";
+	}
+	sqlite3_finalize(stmt);
+
+	sqlite3_close(symbols);
+	return ok;
+}
+
+bool DeclWriter::prepareStatements() {
+	for (int i = 0; i < NR_STATEMENTS; i++) {
+		if (sqlite3_prepare_v2(db, statements[i], -1, &stmts[i], NULL) != SQLITE_OK) {
+			llvm::errs() << statements[i] << ": " << sqlite3_errmsg(db) << "\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+void DeclWriter::finalizeStatements() {
+	for (int i = 0; i < NR_STATEMENTS; i++) {
+		sqlite3_finalize(stmts[i]);
+		stmts[i] = NULL;
+	}
+}
+
+bool DeclWriter::copyDatabase(sqlite3 *from, sqlite3 *to) {
+	sqlite3_backup *backup = sqlite3_backup_init(to, "main", from, "main");
+	if (!backup) {
+		llvm::errs() << "backup to " << target << " failed: " << sqlite3_errmsg(to) << "\n";
+		return false;
+	}
+	sqlite3_backup_step(backup, -1);
+	return sqlite3_backup_finish(backup) == SQLITE_OK;
+}
+
+sqlite3_stmt *DeclWriter::begin(Statement s) {
+	if (!db)
+		return NULL;
+	sqlite3_stmt *stmt = stmts[s];
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	return stmt;
+}
+
+llvm::StringRef DeclWriter::text(sqlite3_stmt *stmt, int i) {
+	const char *s = reinterpret_cast<const char *>(sqlite3_column_text(stmt, i));
+	return s ? llvm::StringRef(s, sqlite3_column_bytes(stmt, i)) : llvm::StringRef();
+}
+
+void DeclWriter::bind(sqlite3_stmt *stmt, int i, llvm::StringRef text) {
+	sqlite3_bind_text(stmt, i, text.data(), text.size(), SQLITE_TRANSIENT);
+}
+
+void DeclWriter::bind(sqlite3_stmt *stmt, int i, int value) {
+	sqlite3_bind_int(stmt, i, value);
+}
+
+void DeclWriter::step(Statement s) {
+	sqlite3_stmt *stmt = stmts[s];
+	if (sqlite3_step(stmt) != SQLITE_DONE)
+		llvm::errs() << sqlite3_sql(stmt) << ": " << sqlite3_errmsg(db) << "\n";
+	count(s, sqlite3_changes(db) != 0);
+
+	if (chunkSize && ++pending >= chunkSize) {
+		TraceScope scope(PluginTrace::get(), "commit");
+		sqlite3_exec(db, "COMMIT; BEGIN;", 0, 0, 0);
+		pending = 0;
+	}
+}
+
+void DeclWriter::count(Statement s, bool written) {
+	PluginTrace::get().count(written ? insertedCounters[s] : ignoredCounters[s]);
+}
+
+void DeclWriter::addMacro(llvm::StringRef header, llvm::StringRef name,
+						  int startLine, int startColumn, int endLine, int endColumn,
+						  int startOffset, int endOffset) {
+	if (index) {
+		count(STMT_MACRO, index->addMacro(header, name, startLine, startColumn, endLine, endColumn,
+										  startOffset, endOffset));
+		return;
+	}
+
+	sqlite3_stmt *stmt = begin(STMT_MACRO);
+	if (!stmt)
+		return;
+	bind(stmt, 1, header);
+	bind(stmt, 2, name);
+	bind(stmt, 3, startLine);
+	bind(stmt, 4, startColumn);
+	bind(stmt, 5, endLine);
+	bind(stmt, 6, endColumn);
+	bind(stmt, 7, startOffset);
+	bind(stmt, 8, endOffset);
+	step(STMT_MACRO);
+}
+
+void DeclWriter::addDep(llvm::StringRef header, llvm::StringRef included,
+						llvm::StringRef includedPath, int line) {
+	if (index) {
+		count(STMT_DEP, index->addDep(header, included, includedPath, line));
+		return;
+	}
+
+	sqlite3_stmt *stmt = begin(STMT_DEP);
+	if (!stmt)
+		return;
+	bind(stmt, 1, header);
+	bind(stmt, 2, included);
+	bind(stmt, 3, includedPath);
+	bind(stmt, 4, line);
+	step(STMT_DEP);
+}
+
+void DeclWriter::setForceKeep(llvm::StringRef header, llvm::StringRef includedPath) {
+	if (index) {
+		index->setForceKeep(header, includedPath);
+		return;
+	}
+
+	sqlite3_stmt *stmt = begin(STMT_DEP_FORCE_KEEP);
+	if (!stmt)
+		return;
+	bind(stmt, 1, header);
+	bind(stmt, 2, includedPath);
+	step(STMT_DEP_FORCE_KEEP);
+}
+
+void DeclWriter::addDecl(llvm::StringRef header, llvm::StringRef name,
+						 int startLine, int startColumn, int endLine, int endColumn,
+						 int kind, int fromMacro, int hasBody, int startOffset, int endOffset) {
+	if (index) {
+		count(STMT_DECL, index->addDecl(header, name, startLine, startColumn, endLine, endColumn,
+										kind, fromMacro, hasBody, startOffset, endOffset));
+		return;
+	}
+
+	sqlite3_stmt *stmt = begin(STMT_DECL);
+	if (!stmt)
+		return;
+	bind(stmt, 1, header);
+	bind(stmt, 2, name);
+	bind(stmt, 3, startLine);
+	bind(stmt, 4, startColumn);
+	bind(stmt, 5, endLine);
+	bind(stmt, 6, endColumn);
+	bind(stmt, 7, kind);
+	bind(stmt, 8, fromMacro);
+	bind(stmt, 9, hasBody);
+	bind(stmt, 10, startOffset);
+	bind(stmt, 11, endOffset);
+	step(STMT_DECL);
+}
+
+void DeclWriter::addAllDecl(llvm::StringRef header, llvm::StringRef ident,
+							int startLine, int startColumn, int endLine, int endColumn) {
+	if (index) {
+		count(STMT_ALL_DECL, index->addAllDecl(header, ident, startLine, startColumn, endLine, endColumn));
+		return;
+	}
+
+	sqlite3_stmt *stmt = begin(STMT_ALL_DECL);
+	if (!stmt)
+		return;
+	bind(stmt, 1, header);
+	bind(stmt, 2, ident);
+	bind(stmt, 3, startLine);
+	bind(stmt, 4, startColumn);
+	bind(stmt, 5, endLine);
+	bind(stmt, 6, endColumn);
+	step(STMT_ALL_DECL);
+}
+
+void DeclWriter::addPrototype(llvm::StringRef name, llvm::StringRef prototype,
+							  llvm::StringRef header, int isFunction,
+							  int commentStart, int commentEnd, llvm::StringRef comment) {
+	if (index) {
+		count(STMT_PROTOTYPE, index->addPrototype(name, prototype, header, isFunction,
+												  commentStart, commentEnd, comment));
+		return;
+	}
+
+	sqlite3_stmt *stmt = begin(STMT_PROTOTYPE);
+	if (!stmt)
+		return;
+	bind(stmt, 1, name);
+	bind(stmt, 2, prototype);
+	bind(stmt, 3, header);
+	bind(stmt, 4, isFunction);
+	bind(stmt, 5, commentStart);
+	bind(stmt, 6, commentEnd);
+	bind(stmt, 7, comment);
+	step(STMT_PROTOTYPE);
+}
+
+void DeclWriter::addMacroDep(llvm::StringRef header, llvm::StringRef name,
+							 llvm::StringRef ident, int kind) {
+	if (index) {
+		count(STMT_MACRO_DEP, index->addMacroDep(header, name, ident, kind));
+		return;
+	}
+
+	sqlite3_stmt *stmt = begin(STMT_MACRO_DEP);
+	if (!stmt)
+		return;
+	bind(stmt, 1, header);
+	bind(stmt, 2, name);
+	bind(stmt, 3, ident);
+	bind(stmt, 4, kind);
+	step(STMT_MACRO_DEP);
+}
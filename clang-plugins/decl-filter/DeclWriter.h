@@ -0,0 +1,121 @@
+//===- DeclWriter.h -------------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Batched SQLite writer used by DeclFilter. Every table gets a cached prepared
+// statement, values are bound instead of being formatted into SQL text, and
+// rows are committed in chunks. Optionally all rows are staged in an
+// in-memory database which is copied to the target file when closing, or
+// written out as a binary DeclIndex instead of a database.
+//
+// The writer owns the schema: every database is created from scratch next
+// to its target and renamed over it when closing, and carries the version of
+// its schema in PRAGMA user_version (see common/DeclSchema.h).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef DECL_WRITER_H
+#define DECL_WRITER_H
+
+#include "DeclIndex.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+class DeclWriter {
+public:
+	enum Statement {
+		STMT_MACRO,
+		STMT_DEP,
+		STMT_DEP_FORCE_KEEP,
+		STMT_DECL,
+		STMT_ALL_DECL,
+		STMT_PROTOTYPE,
+		STMT_MACRO_DEP,
+		NR_STATEMENTS
+	};
+
+	/// MacroDep - A row of macro_deps: @ident appears in the body of the
+	/// macro @name defined in @header and is a MACRO_DEP_DECL or a
+	/// MACRO_DEP_MACRO.
+	struct MacroDep {
+		std::string header, name, ident;
+		int kind;
+	};
+
+	static const unsigned DEFAULT_CHUNK_SIZE = 10000;
+
+	DeclWriter();
+	~DeclWriter();
+
+	/// open - Start a new database replacing @path once closed. If @inMemory
+	/// is set, rows are staged in an in-memory database. A transaction is
+	/// committed every @chunkSize rows (0 means a single transaction).
+	bool open(const std::string &path, bool inMemory = false,
+			  unsigned chunkSize = DEFAULT_CHUNK_SIZE);
+	/// openIndex - Collect all rows in memory and write them to @path as a
+	/// binary DeclIndex in close().
+	bool openIndex(const std::string &path);
+	void close();
+	/// importPrefix - Copy the macros, macro_deps and deps recorded by a run
+	/// over the precompiled prefix header, whose preprocessor events are not
+	/// replayed when a PCH is loaded. Deps of the prefix header itself are
+	/// skipped. The macro_deps rows are appended to @macroDeps if given.
+	bool importPrefix(const std::string &path, std::vector<MacroDep> *macroDeps = NULL);
+	/// loadSymbolHeaders - Add the headers covered by the kernel-wide symbol
+	/// database at @path, whose all_decls is built by DumpDecls, to @headers.
+	static bool loadSymbolHeaders(const std::string &path, llvm::StringSet<> &headers);
+	bool isOpen() const { return db != NULL || index.get() != NULL; }
+
+	void addMacro(llvm::StringRef header, llvm::StringRef name,
+				  int startLine, int startColumn, int endLine, int endColumn,
+				  int startOffset, int endOffset);
+	void addDep(llvm::StringRef header, llvm::StringRef included,
+				llvm::StringRef includedPath, int line);
+	void setForceKeep(llvm::StringRef header, llvm::StringRef includedPath);
+	void addDecl(llvm::StringRef header, llvm::StringRef name,
+				 int startLine, int startColumn, int endLine, int endColumn,
+				 int kind, int fromMacro, int hasBody, int startOffset, int endOffset);
+	void addAllDecl(llvm::StringRef header, llvm::StringRef ident,
+					int startLine, int startColumn, int endLine, int endColumn);
+	void addPrototype(llvm::StringRef name, llvm::StringRef prototype,
+					  llvm::StringRef header, int isFunction,
+					  int commentStart, int commentEnd, llvm::StringRef comment);
+	void addMacroDep(llvm::StringRef header, llvm::StringRef name,
+					 llvm::StringRef ident, int kind);
+
+private:
+	sqlite3 *db;
+	sqlite3_stmt *stmts[NR_STATEMENTS];
+	llvm::OwningPtr<DeclIndexBuilder> index;
+	std::string target;
+	// Where the database is built until close() renames it to @target
+	std::string temp;
+	bool inMemory;
+	unsigned chunkSize;
+	unsigned pending;
+
+	bool prepareStatements();
+	void finalizeStatements();
+	/// discard - Drop the database being built, leaving @target as it was.
+	void discard();
+	bool copyDatabase(sqlite3 *from, sqlite3 *to);
+
+	sqlite3_stmt *begin(Statement s);
+	void bind(sqlite3_stmt *stmt, int i, llvm::StringRef text);
+	void bind(sqlite3_stmt *stmt, int i, int value);
+	void step(Statement s);
+	void count(Statement s, bool written);
+	static llvm::StringRef text(sqlite3_stmt *stmt, int i);
+};
+
+#endif /* DECL_WRITER_H */
@@ -0,0 +1,290 @@
+//===- SourceExtent.cpp ---------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Exact extents of declarations and macro definitions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SourceExtent.h"
+#include "clang/AST/Decl.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/MacroInfo.h"
+using namespace clang;
+
+#include <cctype>
+
+static unsigned lineStart(llvm::StringRef buf, unsigned off) {
+	while (off > 0 && buf[off - 1] != '\n')
+		off --;
+	return off;
+}
+
+static unsigned lineEnd(llvm::StringRef buf, unsigned off) {
+	size_t end = buf.find('\n', off);
+	return end == llvm::StringRef::npos ? buf.size() : end;
+}
+
+/// logicalLineEnd - Offset of the newline ending the line @off is in,
+/// following backslash continuations and block comments spanning lines.
+static unsigned logicalLineEnd(llvm::StringRef buf, unsigned off) {
+	while (off < buf.size()) {
+		llvm::StringRef rest = buf.substr(off);
+		if (rest.startswith("\\\n")) {
+			off += 2;
+		} else if (rest.startswith("\\\r\n")) {
+			off += 3;
+		} else if (rest.startswith("/*")) {
+			size_t close = buf.find("*/", off + 2);
+			if (close == llvm::StringRef::npos)
+				return buf.size();
+			off = close + 2;
+		} else if (rest.startswith("//")) {
+			return lineEnd(buf, off);
+		} else if (buf[off] == '\n') {
+			return off;
+		} else {
+			off ++;
+		}
+	}
+	return off;
+}
+
+/// extendLeadingComment - Include the comment ending on the line before the
+/// entity starting at @start, as long as the comment starts a line itself.
+static unsigned extendLeadingComment(llvm::StringRef buf, unsigned start) {
+	unsigned ls = lineStart(buf, start);
+	if (ls == 0 || !buf.slice(ls, start).trim().empty())
+		return start;
+
+	unsigned prevStart = lineStart(buf, ls - 1);
+	llvm::StringRef prev = buf.slice(prevStart, ls - 1).rtrim();
+	if (!prev.endswith("*/"))
+		return start;
+
+	unsigned close = prevStart + prev.size() - 2;
+	size_t open = buf.substr(0, close).rfind("/*");
+	if (open == llvm::StringRef::npos || lineStart(buf, open) != open)
+		return start;
+	return open;
+}
+
+/// extendTrailingComment - Include a comment following @end on the same line.
+static unsigned extendTrailingComment(llvm::StringRef buf, unsigned end) {
+	unsigned p = end;
+	while (p < buf.size() && (buf[p] == ' ' || buf[p] == '\t'))
+		p ++;
+
+	llvm::StringRef rest = buf.substr(p);
+	if (rest.startswith("/*")) {
+		size_t close = buf.find("*/", p + 2);
+		if (close != llvm::StringRef::npos)
+			return close + 2;
+	} else if (rest.startswith("//")) {
+		return lineEnd(buf, p);
+	}
+	return end;
+}
+
+/// findTerminator - Offset right after the ';' terminating the declaration
+/// whose last token ends at @off. Tokens in between, e.g. attributes from
+/// macros expanding to nothing, are skipped. Unless @crossLines is set the
+/// search stops at the next line, so that a macro invocation which is not
+/// followed by ';' does not swallow the next declaration.
+static unsigned findTerminator(const SourceManager &SM, const LangOptions &LO,
+							   FileID FID, llvm::StringRef buf, unsigned off,
+							   bool crossLines) {
+	Lexer L(SM.getLocForStartOfFile(FID), LO, buf.begin(), buf.begin() + off, buf.end());
+	Token Tok;
+	int depth = 0;
+	bool first = true;
+
+	while (true) {
+		L.LexFromRawLexer(Tok);
+		if (Tok.is(tok::eof))
+			break;
+		// Note: the first token is always at the start of the raw buffer
+		if (!first && Tok.isAtStartOfLine() && (Tok.is(tok::hash) || (!crossLines && depth == 0)))
+			break;
+		first = false;
+
+		switch (Tok.getKind()) {
+		case tok::l_paren:
+		case tok::l_square:
+		case tok::l_brace:
+			depth ++;
+			break;
+		case tok::r_paren:
+		case tok::r_square:
+		case tok::r_brace:
+			if (--depth < 0)
+				return off;
+			break;
+		case tok::semi:
+			if (depth == 0)
+				return SM.getFileOffset(Tok.getLocation()) + 1;
+			break;
+		default:
+			break;
+		}
+	}
+	return off;
+}
+
+SourceExtent getDeclExtent(const SourceManager &SM, const LangOptions &LO, const Decl *D) {
+	SourceExtent extent;
+	SourceLocation B = D->getLocStart(), E = D->getLocEnd();
+	bool fromMacro = B.isMacroID() || E.isMacroID();
+
+	// Note: keep whole macro invocations declaring things
+	if (B.isMacroID())
+		B = SM.getExpansionRange(B).first;
+	if (E.isMacroID())
+		E = SM.getExpansionRange(E).second;
+	if (B.isInvalid() || E.isInvalid())
+		return extent;
+
+	// Note: a tag defined in a typedef or variable declaration, e.g.
+	//       'typedef struct {...} atomic_t;', is not complete without it.
+	//       The decls of that declaration follow the tag and start before
+	//       it, so it extends over all of them.
+	if (isa<TagDecl>(D)) {
+		SourceLocation TagB = B;
+		for (const Decl *N = D->getNextDeclInContext(); N; N = N->getNextDeclInContext()) {
+			SourceLocation NB = N->getLocStart(), NE = N->getLocEnd();
+			if (NB.isMacroID())
+				NB = SM.getExpansionRange(NB).first;
+			if (NE.isMacroID())
+				NE = SM.getExpansionRange(NE).second;
+			if (NB.isInvalid() || NE.isInvalid() || SM.isBeforeInTranslationUnit(TagB, NB))
+				break;
+			if (SM.isBeforeInTranslationUnit(NB, B))
+				B = NB;
+			E = NE;
+		}
+	}
+
+	std::pair<FileID, unsigned> b = SM.getDecomposedLoc(B), e = SM.getDecomposedLoc(E);
+	if (b.first != e.first)
+		return extent;
+
+	bool invalid = false;
+	llvm::StringRef buf = SM.getBufferData(b.first, &invalid);
+	if (invalid)
+		return extent;
+
+	unsigned end = e.second + Lexer::MeasureTokenLength(E, SM, LO);
+	const FunctionDecl *FD = dyn_cast<FunctionDecl>(D);
+	if (!FD || !FD->doesThisDeclarationHaveABody())
+		end = findTerminator(SM, LO, b.first, buf, end, !fromMacro);
+
+	extent.start = extendLeadingComment(buf, b.second);
+	extent.end = extendTrailingComment(buf, end);
+	return extent;
+}
+
+SourceExtent getLeadingComment(const SourceManager &SM, const Decl *D, llvm::StringRef &text) {
+	SourceExtent extent;
+	SourceLocation B = D->getLocStart();
+
+	text = llvm::StringRef();
+	if (B.isMacroID())
+		B = SM.getExpansionRange(B).first;
+	if (B.isInvalid())
+		return extent;
+
+	std::pair<FileID, unsigned> b = SM.getDecomposedLoc(B);
+	bool invalid = false;
+	llvm::StringRef buf = SM.getBufferData(b.first, &invalid);
+	if (invalid)
+		return extent;
+
+	// Note: clang 3.3 keeps doc comments (/** and ///) only, so plain block
+	//       comments, which most of the kernel has, are found in the buffer.
+	//       The comment runs up to the line of the decl, newline included.
+	unsigned start = extendLeadingComment(buf, b.second);
+	if (start == b.second)
+		return extent;
+	extent.start = start;
+	extent.end = lineStart(buf, b.second);
+	text = buf.slice(extent.start, extent.end);
+	return extent;
+}
+
+static bool isDirective(llvm::StringRef line, llvm::StringRef directive,
+						llvm::StringRef arg = llvm::StringRef()) {
+	if (!line.startswith("#"))
+		return false;
+	line = line.substr(1).ltrim();
+	if (!line.startswith(directive))
+		return false;
+	if (arg.empty())
+		return true;
+	line = line.substr(directive.size());
+	if (line.empty() || (line[0] != ' ' && line[0] != '\t'))
+		return false;
+	line = line.ltrim();
+	return line.startswith(arg) &&
+		(line.size() == arg.size() || (!isalnum(line[arg.size()]) && line[arg.size()] != '_'));
+}
+
+SourceExtent getMacroExtent(const SourceManager &SM, const LangOptions &LO,
+							const IdentifierInfo *II, const MacroInfo *MI) {
+	SourceExtent extent;
+	SourceLocation B = MI->getDefinitionLoc(), E = MI->getDefinitionEndLoc();
+	if (B.isInvalid() || E.isInvalid() || !B.isFileID() || !E.isFileID())
+		return extent;
+
+	std::pair<FileID, unsigned> b = SM.getDecomposedLoc(B), e = SM.getDecomposedLoc(E);
+	if (b.first != e.first)
+		return extent;
+
+	bool invalid = false;
+	llvm::StringRef buf = SM.getBufferData(b.first, &invalid);
+	if (invalid)
+		return extent;
+
+	unsigned start = lineStart(buf, b.second);
+	unsigned end = logicalLineEnd(buf, e.second + Lexer::MeasureTokenLength(E, SM, LO));
+
+	// Note: keep the guard of a conditional definition, e.g.
+	//         #ifndef pr_fmt
+	//         #define pr_fmt(fmt) fmt
+	//         #endif
+	//       as the macro would be redefined otherwise
+	if (start > 0 && end < buf.size()) {
+		unsigned prevStart = lineStart(buf, start - 1);
+		unsigned nextEnd = lineEnd(buf, end + 1);
+		llvm::StringRef prev = buf.slice(prevStart, start - 1).trim();
+		llvm::StringRef next = buf.slice(end + 1, nextEnd).trim();
+		if (isDirective(prev, "ifndef", II->getName()) && isDirective(next, "endif")) {
+			start = prevStart;
+			end = nextEnd;
+		}
+	}
+
+	extent.start = extendLeadingComment(buf, start);
+	extent.end = end;
+	return extent;
+}
+
+SourceExtent getDirectiveExtent(const SourceManager &SM, SourceLocation Loc) {
+	SourceExtent extent;
+	if (Loc.isInvalid() || !Loc.isFileID())
+		return extent;
+
+	std::pair<FileID, unsigned> l = SM.getDecomposedLoc(Loc);
+	bool invalid = false;
+	llvm::StringRef buf = SM.getBufferData(l.first, &invalid);
+	if (invalid)
+		return extent;
+
+	extent.start = lineStart(buf, l.second);
+	extent.end = logicalLineEnd(buf, extent.start);
+	return extent;
+}
@@ -0,0 +1,64 @@
+//===- SourceExtent.h -----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Exact extents of declarations and macro definitions in their files, as
+// [start, end) byte offsets. An extent covers everything DeclComposer.py has
+// to copy for the entity to be complete:
+//
+//   - the terminating ';' of declarations without a body, even when tokens
+//     before it come from macros expanding to nothing;
+//   - whole macro invocations declaring things;
+//   - continuation lines of macro definitions;
+//   - the comment attached before the entity and a comment trailing it on
+//     its last line;
+//   - '#ifndef NAME' / '#endif' guards wrapping a single macro definition.
+//
+// The comment attached before a decl is also available on its own, for the
+// stubs the composer writes for undefined symbols.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SOURCE_EXTENT_H
+#define SOURCE_EXTENT_H
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceManager.h"
+
+namespace clang {
+class Decl;
+class IdentifierInfo;
+class MacroInfo;
+}
+
+struct SourceExtent {
+	unsigned start;
+	unsigned end;
+
+	SourceExtent() : start(0), end(0) {}
+	bool isValid() const { return start < end; }
+};
+
+/// getDeclExtent - The extent of the top-level decl @D.
+SourceExtent getDeclExtent(const clang::SourceManager &SM, const clang::LangOptions &LO,
+						   const clang::Decl *D);
+
+/// getLeadingComment - The extent of the comment attached before the
+/// top-level decl @D, with its text in @text. Invalid if there is none.
+SourceExtent getLeadingComment(const clang::SourceManager &SM, const clang::Decl *D,
+							   llvm::StringRef &text);
+
+/// getMacroExtent - The extent of the definition of macro @II.
+SourceExtent getMacroExtent(const clang::SourceManager &SM, const clang::LangOptions &LO,
+							const clang::IdentifierInfo *II, const clang::MacroInfo *MI);
+
+/// getDirectiveExtent - The extent of the preprocessor directive at @Loc,
+/// e.g. an #undef.
+SourceExtent getDirectiveExtent(const clang::SourceManager &SM, clang::SourceLocation Loc);
+
+#endif /* SOURCE_EXTENT_H */
@@ -18,7 +18,9 @@
 #include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
 #include "llvm/Support/raw_ostream.h"
 using namespace clang;
 
@@ -26,6 +28,13 @@ using namespace clang;
 #include <cstdio>
 #include <vector>
 #include <sqlite3.h>
+#include <unistd.h>
+
+#include "DeclSchema.h"
+#include "DeclaratorPrinter.h"
+#include "ExploredIndex.h"
+#include "LocationCache.h"
+#include "PluginTrace.h"
 
 enum {
 	TYPE_MACRO = 1,
@@ -38,21 +47,56 @@ enum {
 };
 
 static const int BUF_SIZE = 40960;
-std::map<std::string, int> explored;
 #define errs outs
 
-/// simplify path like aaa/xxx/../bbb to aaa/bbb
-static std::string SimplifyPath(std::string path) {
-	if (path.find("/../") == std::string::npos)
-		return path;
-	while (path.find("/../") != std::string::npos) {
-		int pos_dot = path.find("/../");
-		int pos_delete = path.rfind("/", pos_dot - 1);
-		std::string left = path.substr(0, pos_delete + 1);
-		std::string right = path.substr(pos_dot + 4, path.length() - pos_dot - 4);
-		path = left + right;
+// With the 'symbols' argument, the named top-level decls are recorded in the
+// all_decls table of DeclFilter instead, as the kernel-wide symbol database
+// the composer looks identifiers up in (see common/DeclSchema.h).
+static const DeclTable symbolsTables[] = { TABLE_ALL_DECLS };
+
+static PluginTrace &trace = PluginTrace::get();
+// Decls dumped by this and earlier runs over the tree, by location and name
+static ExploredIndex explored;
+
+/// isExplored - Whether the decl @name at @location was dumped before.
+/// Otherwise it is recorded as explored.
+static bool isExplored(llvm::StringRef location, llvm::StringRef name) {
+	if (!explored.isOpen() || explored.insert(location, name))
+		return false;
+	trace.count("explored.hits");
+	return true;
+}
+
+/// isNewDatabase - Whether @conn holds no decls yet, e.g. as it was deleted
+/// and created anew. An explored index left from earlier runs would then
+/// skip decls which are stored nowhere.
+static bool isNewDatabase(sqlite3 *conn) {
+	sqlite3_stmt *stmt;
+	if (sqlite3_prepare_v2(conn, "SELECT 1 FROM decls LIMIT 1", -1, &stmt, NULL) != SQLITE_OK)
+		return true;
+	bool empty = sqlite3_step(stmt) != SQLITE_ROW;
+	sqlite3_finalize(stmt);
+	return empty;
+}
+
+/// execSQL - Run @sql, counting the rows inserted and the statements which
+/// failed, e.g. on duplicates.
+static bool execSQL(sqlite3 *conn, const char *sql) {
+	char *errmsg;
+	if (sqlite3_exec(conn, sql, 0, 0, &errmsg) != SQLITE_OK) {
+		trace.count("rows.failed");
+		llvm::errs() << sql << ": " << errmsg << "\n";
+		sqlite3_free(errmsg);
+		return false;
 	}
-	return path;
+	trace.count("rows.inserted");
+	return true;
+}
+
+/// "file:line" of a location, as printed by SourceLocation::printToString()
+/// without the column
+static std::string locationString(const FileLocation &L) {
+	return (L.name + ":" + llvm::Twine(L.line)).str();
 }
 
 /// PrintMacroDefinition - Print a macro definition in a form that will be
@@ -114,29 +158,28 @@ std::string& replace_all(std::string& str, const std::string& old_value, const s
 class DumpMacrosCallbacks : public PPCallbacks {
 	Preprocessor &PP;
 	SourceManager& SM;
+	LocationCache& locations;
 
 	sqlite3 *conn;
 	char sqlbuf[BUF_SIZE];
-	char *errmsg;
 
 	std::string lastIncluded;
 	std::vector<std::string> fileStack;
 
 public:
-	explicit DumpMacrosCallbacks(Preprocessor& pp, SourceManager& sm, sqlite3 *conn = NULL)
-		: PP(pp), SM(sm), conn(conn) {}
+	explicit DumpMacrosCallbacks(Preprocessor& pp, SourceManager& sm, LocationCache& lc, sqlite3 *conn = NULL)
+		: PP(pp), SM(sm), locations(lc), conn(conn) {}
 
 	virtual void MacroDefined(const Token &MacroNameTok, const MacroDirective *MD) {
-		std::string loc = MacroNameTok.getLocation().printToString(SM);
+		trace.count("pp.MacroDefined");
+		FileLocation L = locations.getExpansionLoc(MacroNameTok.getLocation());
 		std::string name, def;
 		llvm::raw_string_ostream os(def);
-		
-//		llvm::errs() << "Enter MacroDefined, loc = " << loc << '\n';
-		// Ignore builtin macros
-		if (loc.find("<built-in>:") != std::string::npos)
-			return;
-		if (loc.find("<command line>:") != std::string::npos)
+
+		// Ignore builtin macros, i.e. those from <built-in> and <command line>
+		if (!L.isFile)
 			return;
+		std::string loc = (locationString(L) + ":" + llvm::Twine(L.column)).str();
 //		if (loc.find("linux/kconfig.h") != std::string::npos)
 //			return;
 //		if (loc.find("generated/autoconf.h") != std::string::npos)
@@ -148,23 +191,13 @@ public:
 		PrintMacroDefinition(*II, *MI, PP, os);
 		
 		if (conn) {
-			std::size_t first = loc.find(':'), second = loc.find(':', first + 1);
-			std::string file = loc.substr(0, first), linum = loc.substr(first + 1, second - first - 1);
-		
-			// remove /../
-			file = SimplifyPath(file);			
-	
-			if (explored.find(loc) != explored.end()) {
-//				llvm::errs() << "find file in explored, ignore it\n";
+			if (isExplored(loc, name))
 				return;
-			} else
-				RecordExploredFiles(loc + name);
 
 			def = replace_all(def, "'", "''");
-			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %s, '%s')",
-					 name.c_str(), TYPE_MACRO, file.c_str(), linum.c_str(), os.str().c_str());
-			if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-				llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %u, '%s')",
+					 name.c_str(), TYPE_MACRO, L.path.str().c_str(), L.line, os.str().c_str());
+			execSQL(conn, sqlbuf);
 		} else {
 			llvm::outs() << loc << ":\t" << os.str() << "\n";
 		}
@@ -179,50 +212,35 @@ public:
 							 StringRef SearchPath,
 							 StringRef RelativePath,
 							 const Module *Imported) {
-		std::string loc = HashLoc.printToString(SM);
-		std::size_t first = loc.find(':'), second = loc.find(':', first + 1);
-		std::string file = loc.substr(0, first), linum = loc.substr(first + 1, second - first - 1);
+		trace.count("pp.InclusionDirective");
+		FileLocation L = locations.getExpansionLoc(HashLoc);
 
-		if (loc.find("<built-in>:") != std::string::npos)
+		if (!L.isFile)
 			return;
-		if (loc.find("<command line>:") != std::string::npos)
+		if (L.name.find("linux/kconfig.h") != llvm::StringRef::npos)
 			return;
-		if (loc.find("linux/kconfig.h") != std::string::npos)
-			return;
-		if (loc.find("generated/autoconf.h") != std::string::npos)
+		if (L.name.find("generated/autoconf.h") != llvm::StringRef::npos)
 			return;
 
 		if (conn) {
 			if (!fileStack.empty()) {
-				snprintf(sqlbuf, BUF_SIZE, "INSERT INTO incdeps VALUES ('%s', %s, '%s')",
-						 fileStack.back().c_str(), linum.c_str(), FileName.str().c_str());
-				if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-					llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+				snprintf(sqlbuf, BUF_SIZE, "INSERT INTO incdeps VALUES ('%s', %u, '%s')",
+						 fileStack.back().c_str(), L.line, FileName.str().c_str());
+				execSQL(conn, sqlbuf);
 			}
 		} else {
 			if (!fileStack.empty())
 				llvm::outs() << "[" << fileStack.back() << "] ";
-			llvm::outs() << loc << " => " << FileName << "\n";
+			llvm::outs() << locationString(L) << ":" << L.column << " => " << FileName << "\n";
 		}
 		lastIncluded = FileName.str();
 	}
 
-	/*
-	 * function to record files that had been explored
-	 */
-	void RecordExploredFiles(std::string file) {
-		if (conn && explored.find(file) == explored.end()) {
-			explored.insert(std::pair<std::string, int>(file, 1));
-			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO explored VALUES ('%s')", file.c_str());
-			if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-				llvm::errs() << sqlbuf << ": " << errmsg << '\n';
-		}
-	}
-
 	void FileChanged(SourceLocation Loc,
 					 FileChangeReason Reason,
 					 SrcMgr::CharacteristicKind FileType,
 					 FileID PrevFID) {
+		trace.count("pp.FileChanged");
 		switch (Reason) {
 		case EnterFile:
 //			llvm::errs() << "enter FileChanged, file = " << SM.getFilename(Loc) << ", preFile = " << SM.getFilename(SM.getLocForEndOfFile(PrevFID));
@@ -245,9 +263,12 @@ public:
 
 class DumpDeclsConsumer : public ASTConsumer {
 
+	LocationCache &locations;
 	sqlite3 *conn;
+	// INSERT into all_decls in the 'symbols' mode
+	sqlite3_stmt *symbols;
 	char sqlbuf[BUF_SIZE];
-	char *errmsg;
+	llvm::OwningPtr<DeclaratorPrinter> printer;
 
 	struct DefInfo {
 		std::string def;
@@ -256,15 +277,11 @@ class DumpDeclsConsumer : public ASTConsumer {
 	std::map<std::string, DefInfo> defs;
 
 	std::string getLocStart(const Decl *d) {
-		std::string loc = d->getLocStart().printToString(d->getASTContext().getSourceManager());
-		std::size_t pos = loc.rfind(':');
-		return loc.substr(0, pos);
+		return locationString(locations.getExpansionLoc(d->getLocStart()));
 	}
 
 	std::string getLocation(const Decl *d) {
-		std::string loc = d->getLocEnd().printToString(d->getASTContext().getSourceManager());
-		std::size_t pos = loc.rfind(':');
-		return loc.substr(0, pos);
+		return locationString(locations.getExpansionLoc(d->getLocEnd()));
 	}
 
 
@@ -298,97 +315,58 @@ class DumpDeclsConsumer : public ASTConsumer {
 		return "";
 	}
 
-	std::string printNameWithType(std::string name, std::string type, bool addFormal = false) {
-		/* Handle function pointers */
-		std::size_t pos = type.find("(*)");
-		if (pos != std::string::npos) {
-			std::string acc = type.insert(pos + 2, name);
-			if (addFormal) {
-				char arg[3] = " a";
-				pos = acc.find("(void)");
-				if (pos == std::string::npos) {
-					while ((pos = acc.find(",", pos)) != std::string::npos) {
-						acc = acc.insert(pos, arg);
-						arg[1] ++;
-						pos += 3;
-					}
-					pos = acc.find("...");
-					if (pos == std::string::npos) {
-						pos = 0;
-						while ((pos = acc.find("(*)", pos)) != std::string::npos)
-							pos ++;
-						pos = acc.rfind(")");
-						acc = acc.insert(pos, arg);
-					}
-				}
-			}
-			return acc;
-		}
-
-		if (type.find("typeof") == std::string::npos) {
-			pos = type.find("(");
-			if (pos != std::string::npos) {
-				std::string ingre = "(" + name + ")";
-				std::string acc = type.insert(pos, ingre);
-				return acc;
-			}
-		}
+	void addSymbol(llvm::StringRef header, llvm::StringRef ident,
+				   const FileLocation &s, const FileLocation &e) {
+		sqlite3_bind_text(symbols, 1, header.data(), header.size(), SQLITE_TRANSIENT);
+		sqlite3_bind_text(symbols, 2, ident.data(), ident.size(), SQLITE_TRANSIENT);
+		sqlite3_bind_int(symbols, 3, s.line);
+		sqlite3_bind_int(symbols, 4, s.column);
+		sqlite3_bind_int(symbols, 5, e.line);
+		sqlite3_bind_int(symbols, 6, e.column);
+		if (sqlite3_step(symbols) == SQLITE_DONE && sqlite3_changes(conn))
+			trace.count("rows.all_decls");
+		else
+			trace.count("rows.all_decls.ignored");
+		sqlite3_reset(symbols);
+	}
 
-		/* Handle arrays */
-		pos = type.find("[");
-		if (pos != std::string::npos)
-			return type.insert(pos, name);
+	/// recordSymbol - Record @D as DeclFilter records it in all_decls, with
+	/// the enumerators of enums at the location of their enum.
+	void recordSymbol(const Decl *D) {
+		llvm::StringRef file = locations.getFilename(D->getLocStart());
+		if (file.empty())
+			return;
+		FileLocation s = locations.getExpansionLoc(D->getLocStart());
+		FileLocation e = locations.getExpansionLoc(D->getLocEnd());
 
-		return type + " " + name;
+		if (const NamedDecl *ND = dyn_cast<NamedDecl>(D)) {
+			std::string name = ND->getNameAsString();
+			if (!name.empty())
+				addSymbol(file, name, s, e);
+		}
+		if (const EnumDecl *ED = dyn_cast<EnumDecl>(D)) {
+			for (EnumDecl::enumerator_iterator i = ED->enumerator_begin(), end = ED->enumerator_end();
+				 i != end;
+				 i++)
+				addSymbol(file, i->getName(), s, e);
+		}
 	}
 
 	void printFunction(const FunctionDecl *d) {
 		std::string name = d->getNameAsString();
-		std::string ret = d->getResultType().getAsString();
-		std::vector<std::string> args;
-		std::string location = getLocation(d);
-
-			if (explored.find(location + name) != explored.end()) {
-				return;
-			}
-			else
-				RecordExploredFiles(location + name);
+		FileLocation L = locations.getExpansionLoc(d->getLocEnd());
+		std::string location = locationString(L);
 
-		for (FunctionDecl::param_const_iterator i = d->param_begin(), e = d->param_end();
-			 i != e;
-			 i++) {
-			QualType type = (*i)->getOriginalType();
-			args.push_back(type.getAsString());
-		}
-
-		std::size_t first = location.find(':'), second = location.find(':', first + 1);
-		std::string file = location.substr(0, first), linum = location.substr(first + 1, second - first - 1);
-		std::string def;
-		llvm::raw_string_ostream os(def);
-
-		// remove /../
-		file = SimplifyPath(file);			
-	
-		os << ret << " " << name << "(";
-		char pn[2] = "a";
-		for (int i = 0, size = args.size(); i < size; i++) {
-			// os << args[i] << " " << (char)('a' + i);
-			pn[0] = 'a' + i;
-			os << printNameWithType(pn, args[i]);
-			if (i < size - 1)
-				os << ", ";
-		}
-		if (d->isVariadic())
-			os << ", ...";
-		os << ")";
+		if (isExplored(location, name))
+			return;
 
+		llvm::StringRef proto = printer->printPrototype(d);
 		if (conn) {
-			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %s, '%s')",
-					 name.c_str(), TYPE_FUNCTION, file.c_str(), linum.c_str(), os.str().c_str());
-			if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-				llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %u, '%s')",
+					 name.c_str(), TYPE_FUNCTION, L.path.str().c_str(), L.line, proto.str().c_str());
+			execSQL(conn, sqlbuf);
 		} else {
-			llvm::outs() << location << ":\t" << os.str() << "\n";
+			llvm::outs() << location << ":\t" << proto << "\n";
 		}
 	}
 
@@ -396,17 +374,13 @@ class DumpDeclsConsumer : public ASTConsumer {
 		std::string name = d->getNameAsString();
 		std::vector<std::pair<std::string, std::string> > fields;
 
-		std::string location = getLocation(d);
-		std::size_t first = location.find(':'), second = location.find(':', first + 1);
-		std::string file = location.substr(0, first);
-		int linum = atoi(location.substr(first + 1, second - first - 1).c_str());
+		FileLocation L = locations.getExpansionLoc(d->getLocEnd());
+		std::string location = locationString(L);
+		int linum = L.line;
 		bool anonymous = false;
 	
-			if (explored.find(location + name) != explored.end()) {
-				return;
-			}
-			else
-				RecordExploredFiles(location + name);
+		if (isExplored(location, name))
+			return;
 
 		if (d->getDefinition() && d->getDefinition() != d)
 			return;
@@ -433,6 +407,8 @@ class DumpDeclsConsumer : public ASTConsumer {
 				printEnum(ED, true);
 		}
 
+		// Fields as (name, declarator), or ("", type) for unnamed ones whose
+		// definition is looked up in @defs
 		for (RecordDecl::field_iterator i = d->field_begin(), e = d->field_end();
 			 i != e;
 			 i++) {
@@ -443,9 +419,11 @@ class DumpDeclsConsumer : public ASTConsumer {
 				if (name.empty())
 					type = getTypeString(qt) + nameAnonymous(getLocStart(*i));
 				else
-					type = getTypeString(qt) + nameAnonymous(getLocation(*i));
-			} else {
+					type = getTypeString(qt) + nameAnonymous(getLocation(*i)) + " " + name;
+			} else if (name.empty()) {
 				type = qt.getAsString();
+			} else {
+				type = printer->printDeclarator(qt, name);
 			}
 			fields.push_back(std::make_pair(name, type));
 		}
@@ -461,7 +439,7 @@ class DumpDeclsConsumer : public ASTConsumer {
 			if (field.first == "") {
 				decl = getTypeString(defs[field.second].type) + defs[field.second].def;
 			} else {
-				decl = printNameWithType(field.first, field.second);
+				decl = field.second;
 			}
 			if (conn) {
 				std::string fname = field.first;
@@ -474,8 +452,7 @@ class DumpDeclsConsumer : public ASTConsumer {
 						 d->isUnion() ? "union" : "struct", name.c_str(),
 						 fname.c_str(),
 						 decl.c_str());
-				if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-					llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+				execSQL(conn, sqlbuf);
 			}
 			os << decl << "; ";
 		}
@@ -491,18 +468,14 @@ class DumpDeclsConsumer : public ASTConsumer {
 		if (linumBefore >= 0 && linum > linumBefore)
 			linum = linumBefore;
 
-			// remove /../
-			file = SimplifyPath(file);			
-	
 		if (conn) {
 			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %d, '%s %s %s')",
 					 /*d->isUnion() ? "union" : "struct",*/ name.c_str(),
 					 TYPE_STRUCT,
-					 file.c_str(),
+					 L.path.str().c_str(),
 					 linum,
 					 d->isUnion() ? "union" : "struct", name.c_str(), os.str().c_str());
-			if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-				llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+			execSQL(conn, sqlbuf);
 		} else {
 			llvm::outs() << location << ":\t" << (d->isUnion() ? "union " : "struct ")
 						 << name.c_str() << " " << os.str() << "\n";
@@ -511,48 +484,32 @@ class DumpDeclsConsumer : public ASTConsumer {
 
 	void printTypedef(const TypedefDecl *d) {
 		std::string name = d->getNameAsString();
-		std::string type = d->getUnderlyingType().getAsString();
-		std::string location = getLocation(d);
+		FileLocation L = locations.getExpansionLoc(d->getLocEnd());
+		std::string location = locationString(L);
 
-			if (explored.find(location + name) != explored.end()) {
-				return;
-			}
-			else
-				RecordExploredFiles(location + name);
+		if (isExplored(location, name))
+			return;
 
+		std::string def = "typedef " + printer->printDeclarator(d->getUnderlyingType(), name).str();
 		if (conn) {
-			std::size_t first = location.find(':'), second = location.find(':', first + 1);
-			std::string file = location.substr(0, first), linum = location.substr(first + 1, second - first - 1);
-			std::string def;
-			llvm::raw_string_ostream os(def);
-
-			os << "typedef " << printNameWithType(name, type);
-
-			// remove /../
-			file = SimplifyPath(file);			
-	
-			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %s, '%s')",
-					 name.c_str(), TYPE_TYPEDEF, file.c_str(), linum.c_str(), os.str().c_str());
-			if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-				llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %u, '%s')",
+					 name.c_str(), TYPE_TYPEDEF, L.path.str().c_str(), L.line, def.c_str());
+			execSQL(conn, sqlbuf);
 		} else {
-			llvm::outs() << location << ":\t"
-						 << "typedef " << printNameWithType(name, type) << "\n";
+			llvm::outs() << location << ":\t" << def << "\n";
 		}
 	}
 
 	void printEnum(const EnumDecl *d, bool recording = false) {
 		std::string name = d->getNameAsString();
-		std::string location = getLocation(d);
+		FileLocation L = locations.getExpansionLoc(d->getLocEnd());
+		std::string location = locationString(L);
 		std::string def;
 		llvm::raw_string_ostream os(def);
 		bool anonymous = false;
 
-			if (explored.find(location + name) != explored.end()) {
-				return;
-			}
-			else
-				RecordExploredFiles(location + name);
+		if (isExplored(location, name))
+			return;
 
 		if (name.empty()) {
 			TypedefNameDecl *tnd = d->getTypedefNameForAnonDecl();
@@ -584,27 +541,21 @@ class DumpDeclsConsumer : public ASTConsumer {
 		}
 
 		if (conn) {
-			std::size_t first = location.find(':'), second = location.find(':', first + 1);
-			std::string file = location.substr(0, first), linum = location.substr(first + 1, second - first - 1);
+			std::string file = L.path;
 
-			// remove /../
-			file = SimplifyPath(file);			
-	
 			if (!name.empty()) {
-				snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %s, '%s')",
-						 name.c_str(), TYPE_ENUM, file.c_str(), linum.c_str(), os.str().c_str());
-				if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-					llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+				snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %u, '%s')",
+						 name.c_str(), TYPE_ENUM, file.c_str(), L.line, os.str().c_str());
+				execSQL(conn, sqlbuf);
 			}
 
 			for (EnumDecl::enumerator_iterator i = d->enumerator_begin(), e = d->enumerator_end();
 				 i != e;
 				 i ++) {
-				snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %s, '%s')",
-						 i->getNameAsString().c_str(), TYPE_ENUM, file.c_str(), linum.c_str(),
+				snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %u, '%s')",
+						 i->getNameAsString().c_str(), TYPE_ENUM, file.c_str(), L.line,
 						 os.str().c_str());
-				if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-					llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+				execSQL(conn, sqlbuf);
 			}
 		} else {
 			llvm::outs() << location << ":\t" << os.str() << "\n";
@@ -613,50 +564,40 @@ class DumpDeclsConsumer : public ASTConsumer {
 
 	void printVar(const VarDecl *d) {
 		std::string name = d->getNameAsString();
-		std::string type = d->getType().getAsString();
-		std::string location = getLocation(d);
+		FileLocation L = locations.getExpansionLoc(d->getLocEnd());
+		std::string location = locationString(L);
 
 		if (conn) {
-			std::size_t first = location.find(':'), second = location.find(':', first + 1);
-			std::string file = location.substr(0, first), linum = location.substr(first + 1, second - first - 1);
-			std::string def;
-			llvm::raw_string_ostream os(def);
-
-			os << "extern " << printNameWithType(name, type);
-
-			if (explored.find(location + name) != explored.end()) {
+			if (isExplored(location, name))
 				return;
-			}
-			else
-				RecordExploredFiles(location + name);
 
-			// remove /../
-			file = SimplifyPath(file);			
-	
-			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %s, '%s')",
-					 name.c_str(), TYPE_VAR, file.c_str(), linum.c_str(), os.str().c_str());
-			if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-				llvm::errs() << sqlbuf << ": " << errmsg << "\n";
+			snprintf(sqlbuf, BUF_SIZE, "INSERT INTO decls VALUES ('%s', %d, '%s', %u, '%s')",
+					 name.c_str(), TYPE_VAR, L.path.str().c_str(), L.line,
+					 printer->printExtern(d).str().c_str());
+			execSQL(conn, sqlbuf);
 		} else {
-			llvm::outs() << location << ":\t"
-						 << "extern " << printNameWithType(name, type) << "\n";
+			llvm::outs() << location << ":\t" << printer->printExtern(d) << "\n";
 		}
 	}
 
-/*
- * function to record files that had been explored
- */
-void RecordExploredFiles(std::string file) {
-	if (conn) {
-		explored.insert(std::pair<std::string, int>(file, 1));
-		snprintf(sqlbuf, BUF_SIZE, "INSERT INTO explored VALUES ('%s')", file.c_str());
-		if (sqlite3_exec(conn, sqlbuf, 0, 0, &errmsg) != SQLITE_OK)
-			llvm::errs() << sqlbuf << ": " << errmsg << '\n';
-	}
-}
+	uint64_t _parseStart;
 
 public:
-	explicit DumpDeclsConsumer(sqlite3 *conn = NULL) : conn(conn) {}
+	explicit DumpDeclsConsumer(LocationCache &lc, sqlite3 *conn = NULL, sqlite3_stmt *symbols = NULL)
+		: locations(lc), conn(conn), symbols(symbols), _parseStart(0) {}
+
+	virtual void Initialize(ASTContext &Context) {
+		_parseStart = trace.isEnabled() ? trace.now() : 0;
+		printer.reset(new DeclaratorPrinter(Context.getPrintingPolicy()));
+	}
+
+	virtual void HandleTranslationUnit(ASTContext &Context) {
+		if (trace.isEnabled()) {
+			SourceManager &SM = Context.getSourceManager();
+			const FileEntry *F = SM.getFileEntryForID(SM.getMainFileID());
+			trace.complete("parse", _parseStart, F ? F->getName() : "");
+		}
+	}
 
 	virtual bool HandleTopLevelDecl(DeclGroupRef DG) {
 //		Decl *d = *DG.begin();
@@ -671,7 +612,10 @@ public:
 				
 		for (DeclGroupRef::iterator i = DG.begin(), e = DG.end(); i != e; i++) {
 			const Decl *D = *i;
-			if (const FunctionDecl *FD = dyn_cast<FunctionDecl>(D))
+			trace.count("decls");
+			if (symbols)
+				recordSymbol(D);
+			else if (const FunctionDecl *FD = dyn_cast<FunctionDecl>(D))
 				printFunction(FD);
 			else if (const RecordDecl *RD = dyn_cast<RecordDecl>(D))
 				printRecord(RD);
@@ -689,17 +633,27 @@ public:
 
 class DumpDeclsAction : public PluginASTAction {
 	sqlite3 *conn;
+	sqlite3_stmt *symbols;
+	llvm::OwningPtr<LocationCache> locations;
+
+	bool openSymbols() {
+		if (!createDeclTables(conn, symbolsTables))
+			return false;
+		return sqlite3_prepare_v2(conn, "INSERT OR IGNORE INTO all_decls VALUES (?, ?, ?, ?, ?, ?)",
+								  -1, &symbols, NULL) == SQLITE_OK;
+	}
 
 protected:
 	ASTConsumer *CreateASTConsumer(CompilerInstance &CI, llvm::StringRef) {
-		return new DumpDeclsConsumer(conn);
+		return new DumpDeclsConsumer(*locations, conn, symbols);
 	}
 
 	bool ParseArgs(const CompilerInstance &CI,
 			       const std::vector<std::string>& args) {
 		conn = NULL;
-		char sqlbuf[BUF_SIZE];
-		char *errmsg;
+		symbols = NULL;
+		std::string exploredPath;
+		bool symbolsMode = false;
 		
 		if (args.size()) {
 			if (args[0] == "help") {
@@ -709,40 +663,91 @@ protected:
 				std::string database = args[0];
 				sqlite3_open(database.c_str(), &conn);
 				sqlite3_exec(conn, "begin;", 0, 0, 0);
+				exploredPath = database + ".explored";
+			}
+		}
 
-				snprintf(sqlbuf, BUF_SIZE, "SELECT * FROM explored");
-				char **result;
-				int nrow = 0, ncolumn = 0;
-				if (sqlite3_get_table(conn, sqlbuf, &result, &nrow, &ncolumn, &errmsg) != SQLITE_OK)
-					llvm::errs() << sqlbuf << ": " << errmsg << '\n';
-				llvm::errs() << "Read " << nrow << " filenames from table explored\n";
-				for (int i = 0; i < nrow; i++) {
-					std::string file(result[i]);
-					explored.insert(std::pair<std::string, int>(file, 1));
-				}
-				sqlite3_free_table(result);
+		for (unsigned i = 1; i < args.size(); i++) {
+			llvm::StringRef arg = args[i];
+			if (arg.startswith("trace=")) {
+				trace.open(arg.substr(6), "dump-decls");
+			} else if (arg.startswith("explored=")) {
+				exploredPath = arg.substr(9);
+			} else if (arg == "symbols") {
+				symbolsMode = true;
+			} else {
+				llvm::errs() << "dump-decls: unknown argument '" << arg << "'\n";
+				return false;
+			}
+		}
+
+		if (symbolsMode) {
+			if (!conn || !openSymbols()) {
+				llvm::errs() << "dump-decls: cannot record symbols\n";
+				return false;
 			}
+			// Note: all_decls is keyed on the decls, runs over the headers of
+			//       the tree simply add to it
+			return true;
+		}
+
+		// Note: the index goes with the decls of its database, so a new
+		//       database starts over with an empty index
+		if (conn && isNewDatabase(conn) && unlink(exploredPath.c_str()) == 0)
+			llvm::errs() << "dump-decls: new database, dropped " << exploredPath << "\n";
+
+		// Note: the index is probed in place, nothing is loaded up front
+		if (conn && !explored.open(exploredPath)) {
+			llvm::errs() << "dump-decls: cannot open explored index " << exploredPath << "\n";
+			return false;
 		}
 
 		return true;
 	}
 
 	void PrintHelp(llvm::raw_ostream& ros) {
-		ros << "Help for DumpDecls plugin goes here\n";
+		ros << "Usage: -plugin-arg-dump-decls <db> [-plugin-arg-dump-decls trace=<json>]\n"
+			<< "       [-plugin-arg-dump-decls explored=<index>] (default <db>.explored)\n"
+			<< "       [-plugin-arg-dump-decls symbols]\n";
 	}
 
 	bool BeginSourceFileAction(CompilerInstance& CI, llvm::StringRef) {
 		Preprocessor &PP = CI.getPreprocessor();
-		PP.addPPCallbacks(new DumpMacrosCallbacks(PP, CI.getSourceManager(), conn));
+		// Note: FileIDs are reset for every input file
+		locations.reset(new LocationCache(CI.getSourceManager()));
+		if (!symbols)
+			PP.addPPCallbacks(new DumpMacrosCallbacks(PP, CI.getSourceManager(), *locations, conn));
 		return true;
 	}
 
 public:
 	virtual ~DumpDeclsAction() {
+		if (symbols)
+			sqlite3_finalize(symbols);
 		if (conn) {
-			sqlite3_exec(conn, "commit;", 0, 0, 0);
+			char *errmsg;
+			int rc;
+			{
+				TraceScope scope(trace, "commit");
+				rc = sqlite3_exec(conn, "commit;", 0, 0, &errmsg);
+			}
+			// Note: the decls explored by this run are added to the index
+			//       only once they are stored, or later runs would skip them
+			//       for good
+			if (rc != SQLITE_OK) {
+				llvm::errs() << "dump-decls: cannot commit, the explored index is left as is: "
+							 << errmsg << "\n";
+				sqlite3_free(errmsg);
+			} else {
+				TraceScope scope(trace, "explored");
+				if (!explored.flush())
+					llvm::errs() << "dump-decls: cannot update the explored index\n";
+			}
+			trace.writeStats(conn);
 			sqlite3_close(conn);
 		}
+		explored.close();
+		trace.close();
 	}
 };
 
@@ -0,0 +1,244 @@
+//===- HeaderVerifier.cpp -------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Resident compiler checking sources against generated headers held in
+// memory, for the error-fixing rounds of DeclComposer.py. It is started once
+// with the clang arguments to compile with and then reads commands from
+// stdin:
+//
+//   file <TAB> <path> <TAB> <size> <NL> <size bytes of content>
+//       Use the content instead of the file at <path> from now on.
+//   check <TAB> <source> <NL>
+//       Parse <source> and report its diagnostics, one per line, as
+//         missing <TAB> <name> <TAB> <message>  (undeclared identifiers,
+//                                                unknown type names,
+//                                                implicit function decls and
+//                                                incomplete types)
+//         error <TAB> <TAB> <message>
+//         note <TAB> <TAB> <message>
+//       followed by
+//         done <TAB> <number of errors> <TAB>
+//   quit <NL>
+//
+// Messages are formatted as clang prints them, i.e. file:line:col: error: ...
+// The file manager is kept across checks, so the headers of the kernel are
+// looked up once.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/DeclarationName.h"
+#include "clang/AST/Type.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "clang/Sema/SemaDiagnostic.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace clang;
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Messages about incomplete types, the same pattern as INCOMPLETE_TYPE in
+// DeclErrors.py
+static llvm::Regex incompleteType("incomplete (definition of |element |result |return )?type '");
+
+/// missingName - The identifier or the incomplete type @Info, formatted as
+/// @message, complains about, if any.
+///
+/// Note: these are the diagnostics the composer resolves from the messages
+///       of clang when there is no verifier (see DeclErrors.py), so that the
+///       headers come out the same either way.
+static std::string missingName(const Diagnostic &Info, llvm::StringRef message) {
+	switch (Info.getID()) {
+	case diag::err_undeclared_var_use:
+	case diag::err_undeclared_var_use_suggest:
+	case diag::err_unknown_typename:
+	case diag::ext_implicit_function_decl:
+	case diag::warn_implicit_function_decl:
+		if (Info.getNumArgs() == 0)
+			break;
+		if (Info.getArgKind(0) == DiagnosticsEngine::ak_identifierinfo)
+			return Info.getArgIdentifier(0)->getName();
+		if (Info.getArgKind(0) == DiagnosticsEngine::ak_declarationname)
+			return DeclarationName::getFromOpaqueInteger(Info.getRawArg(0)).getAsString();
+		break;
+	default:
+		break;
+	}
+
+	// Note: covers incomplete definitions, dereferences of pointers to and
+	//       offsetof() of incomplete types, variables, arrays and results of
+	//       incomplete types... as long as the message says so
+	if (!incompleteType.match(message))
+		return "";
+	for (unsigned i = 0; i < Info.getNumArgs(); i++) {
+		if (Info.getArgKind(i) != DiagnosticsEngine::ak_qualtype)
+			continue;
+		QualType T = QualType::getFromOpaquePtr(reinterpret_cast<void *>(Info.getRawArg(i)));
+		while (const PointerType *PT = T->getAs<PointerType>())
+			T = PT->getPointeeType();
+		if (const TagType *TT = T->getAs<TagType>()) {
+			const TagDecl *TD = TT->getDecl();
+			if (!TD->isCompleteDefinition() && TD->getIdentifier())
+				return TD->getName();
+		}
+	}
+	return "";
+}
+
+/// DiagnosticReporter - Print the errors and notes of a check as records.
+class DiagnosticReporter : public DiagnosticConsumer {
+	llvm::raw_ostream &OS;
+
+public:
+	explicit DiagnosticReporter(llvm::raw_ostream &os) : OS(os) {}
+
+	virtual void HandleDiagnostic(DiagnosticsEngine::Level Level, const Diagnostic &Info) {
+		DiagnosticConsumer::HandleDiagnostic(Level, Info);
+		if (Level != DiagnosticsEngine::Note && Level < DiagnosticsEngine::Error)
+			return;
+
+		llvm::SmallString<256> message;
+		if (Info.getLocation().isValid() && Info.hasSourceManager()) {
+			PresumedLoc PLoc = Info.getSourceManager().getPresumedLoc(Info.getLocation());
+			if (PLoc.isValid()) {
+				llvm::raw_svector_ostream os(message);
+				os << PLoc.getFilename() << ":" << PLoc.getLine() << ":" << PLoc.getColumn() << ": ";
+			}
+		}
+		message += Level == DiagnosticsEngine::Note ? "note: " :
+			Level == DiagnosticsEngine::Fatal ? "fatal error: " : "error: ";
+		Info.FormatDiagnostic(message);
+		for (unsigned i = 0; i < message.size(); i++)
+			if (message[i] == '\n' || message[i] == '\t')
+				message[i] = ' ';
+
+		if (Level == DiagnosticsEngine::Note) {
+			OS << "note\t\t" << message << "\n";
+			return;
+		}
+		std::string name = missingName(Info, message);
+		if (name.empty())
+			OS << "error\t\t" << message << "\n";
+		else
+			OS << "missing\t" << name << "\t" << message << "\n";
+	}
+};
+
+class HeaderVerifier {
+	std::vector<std::string> args;
+	llvm::IntrusiveRefCntPtr<FileManager> files;
+	// Generated headers by path
+	llvm::StringMap<std::string> overlay;
+
+public:
+	explicit HeaderVerifier(const std::vector<std::string> &a)
+		: args(a), files(new FileManager(FileSystemOptions())) {}
+
+	void update(llvm::StringRef path, const std::string &content) {
+		overlay[path] = content;
+	}
+
+	void check(llvm::StringRef source) {
+		llvm::raw_ostream &OS = llvm::outs();
+		DiagnosticReporter reporter(OS);
+		std::string input = source;
+
+		std::vector<const char *> argv;
+		for (unsigned i = 0; i < args.size(); i++)
+			argv.push_back(args[i].c_str());
+		argv.push_back(input.c_str());
+
+		// Note: createInvocationFromCommandLine() adds -fsyntax-only
+		llvm::IntrusiveRefCntPtr<DiagnosticsEngine> diags =
+			CompilerInstance::createDiagnostics(new DiagnosticOptions(), &reporter, false);
+		llvm::OwningPtr<CompilerInvocation> invocation(createInvocationFromCommandLine(argv, diags));
+		if (!invocation) {
+			OS << "error\t\terror: cannot compile " << source << "\n";
+			OS << "done\t1\t\n";
+			OS.flush();
+			return;
+		}
+
+		PreprocessorOptions &PPOpts = invocation->getPreprocessorOpts();
+		for (llvm::StringMap<std::string>::const_iterator i = overlay.begin(), e = overlay.end(); i != e; i++)
+			PPOpts.addRemappedFile(i->getKey(), llvm::MemoryBuffer::getMemBufferCopy(i->getValue(), i->getKey()));
+		PPOpts.RetainRemappedFileBuffers = false;
+
+		CompilerInstance compiler;
+		compiler.setInvocation(invocation.take());
+		compiler.createDiagnostics(&reporter, false);
+		compiler.setFileManager(files.getPtr());
+
+		SyntaxOnlyAction action;
+		compiler.ExecuteAction(action);
+
+		OS << "done\t" << reporter.getNumErrors() << "\t\n";
+		OS.flush();
+	}
+};
+
+static bool readLine(std::string &line) {
+	line.clear();
+	int c;
+	while ((c = getchar()) != EOF && c != '\n')
+		line += (char)c;
+	return c != EOF || !line.empty();
+}
+
+int main(int argc, const char **argv) {
+	if (argc < 2) {
+		llvm::errs() << "Usage: " << argv[0] << " <clang arguments>\n";
+		return 1;
+	}
+
+	HeaderVerifier verifier(std::vector<std::string>(argv + 1, argv + argc));
+	std::string line;
+	while (readLine(line)) {
+		llvm::StringRef command(line);
+		std::pair<llvm::StringRef, llvm::StringRef> fields = command.split('\t');
+
+		if (fields.first == "file") {
+			std::pair<llvm::StringRef, llvm::StringRef> file = fields.second.split('\t');
+			unsigned size;
+			if (file.second.getAsInteger(10, size)) {
+				llvm::errs() << "HeaderVerifier: invalid size in '" << command << "'\n";
+				return 1;
+			}
+			std::string content(size, '\0');
+			if (size && fread(&content[0], 1, size, stdin) != size) {
+				llvm::errs() << "HeaderVerifier: truncated content of " << file.first << "\n";
+				return 1;
+			}
+			verifier.update(file.first, content);
+		} else if (fields.first == "check") {
+			verifier.check(fields.second);
+		} else if (fields.first == "quit") {
+			break;
+		} else {
+			llvm::errs() << "HeaderVerifier: unknown command '" << command << "'\n";
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,8 @@
+#include <closure.h>
+
+struct irq_desc desc;
+irq_id_t id;
+
+unsigned long size(void) {
+	return irq_stat_size() + irq_default;
+}
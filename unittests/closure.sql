@@ -0,0 +1,4 @@
+-- Decls DeclFilter keeps for closure.c: the enum sized into irq_desc, the
+-- anonymous enum of the initializer of irq_default, irq_chip of the typeof()
+-- of irq_id_t and irq_stat of the body of irq_stat_size()
+SELECT header, name FROM decls ORDER BY header, name;
@@ -0,0 +1,31 @@
+enum irq_type {
+	IRQ_NONE,
+	IRQ_EDGE,
+	IRQ_LEVEL,
+	NR_IRQ_TYPES
+};
+
+enum {
+	IRQ_DEFAULT = IRQ_EDGE
+};
+
+struct irq_desc {
+	int handlers[NR_IRQ_TYPES];
+};
+
+struct irq_stat {
+	unsigned long count;
+};
+
+struct irq_chip {
+	int id;
+};
+
+typedef __typeof__(((struct irq_chip *)0)->id) irq_id_t;
+
+static const int irq_default = IRQ_DEFAULT;
+
+static inline unsigned long irq_stat_size(void)
+{
+	return sizeof(struct irq_stat);
+}
@@ -0,0 +1,20 @@
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+struct device {
+	int id;
+	struct list_head node;
+};
+
+enum {
+	DEVICE_ID_SHIFT = 4
+};
+
+extern int __device_id(const struct device *dev);
+
+#define offsetof(type, member) __builtin_offsetof(type, member)
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define to_device(n) container_of(n, struct device, node)
+#define device_id(dev) (__device_id(dev) << DEVICE_ID_SHIFT)
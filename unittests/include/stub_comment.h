@@ -0,0 +1,12 @@
+/*
+ * stub_alloc - allocate @size bytes
+ */
+void *stub_alloc(unsigned long size);
+
+/* number of live allocations */
+extern int stub_count;
+
+int stub_free(void *p);
+
+	/* not attached, it does not start its line */
+void stub_reset(void);
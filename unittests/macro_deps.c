@@ -0,0 +1,8 @@
+#include <macro_deps.h>
+
+#ifdef device_id
+#endif
+
+void *node_device(struct list_head *n) {
+	return to_device(n);
+}
@@ -0,0 +1,3 @@
+-- What the macros expanded by macro_deps.c refer to: the chain to_device ->
+-- container_of -> offsetof (kind 1) and the decls in the bodies (kind 0)
+SELECT header, name, ident, kind FROM macro_deps ORDER BY header, name, ident;
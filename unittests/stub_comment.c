@@ -0,0 +1,9 @@
+#include <stub_comment.h>
+
+void *stub_test(void) {
+	void *p = stub_alloc(stub_count);
+
+	stub_free(p);
+	stub_reset();
+	return p;
+}
@@ -0,0 +1,3 @@
+-- Comments recorded with the prototypes stub_comment.c uses. The comment
+-- of stub_reset() does not start its line, so it is not attached
+SELECT name, comment FROM prototypes ORDER BY name;
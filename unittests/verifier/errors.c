@@ -0,0 +1,49 @@
+/*
+ * Errors the composer resolves, be it from the messages of clang or by
+ * HeaderVerifier. See check-verifier in ../Makefile.
+ */
+
+int undeclared(void) {
+	return undeclared_var;
+}
+
+unknown_t unknown_var;
+
+int implicit(void) {
+	return implicit_fn();
+}
+
+int definition(struct incomplete_definition *p) {
+	return p->field;
+}
+
+void variable(void) {
+	struct incomplete_variable v;
+}
+
+typedef struct incomplete_typedef incomplete_t;
+
+void typedef_variable(void) {
+	incomplete_t v;
+}
+
+void array(void) {
+	struct incomplete_element a[2];
+}
+
+struct incomplete_result result(void) {
+}
+
+struct incomplete_return returned(void);
+
+void call(void) {
+	returned();
+}
+
+unsigned long size(void) {
+	return sizeof(struct incomplete_sizeof);
+}
+
+unsigned long offset(void) {
+	return __builtin_offsetof(struct incomplete_offsetof, field);
+}